@@ -0,0 +1,710 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * flxbench times the decode path in-process. It includes flx.c so the
+ * static decode handlers and checksum can be called directly, and links
+ * against the stand-in mosquitto, ubus, uci and uloop symbols below
+ * instead of the real libraries. Heap traffic is counted by wrapping the
+ * allocator at link time (-Wl,--wrap=malloc,...).
+ */
+
+#include <endian.h>
+#include "flx.c"
+
+#define BENCH_MIN_NSEC			250000000LL
+#define BENCH_MIN_ITERATIONS	16
+#define BENCH_DEVICE			"0123456789abcdef0123456789abcdef"
+
+struct bench_count {
+	unsigned long long allocs;
+	unsigned long long frees;
+	unsigned long long pubs;
+	unsigned long long bytes;
+	unsigned long long events;
+};
+
+static struct bench_count count;
+static volatile int bench_sink; /* keeps inlined results alive */
+/* how the stand-in broker link behaves, see bench_budget_check() */
+static enum {
+	BENCH_LINK_UP, /* QoS 0 is written and reported before returning */
+	BENCH_LINK_STALLED, /* accepted, never reported */
+	BENCH_LINK_FAILING /* refused */
+} bench_link;
+
+struct config conf;
+bool uloop_cancelled;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+	count.allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	count.allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	count.allocs++;
+	if (ptr != NULL) {
+		count.frees++;
+	}
+	return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+	if (ptr != NULL) {
+		count.frees++;
+	}
+	__real_free(ptr);
+}
+
+/* stand-in sinks */
+int mosquitto_publish(struct mosquitto *mosq, int *mid, const char *topic,
+                      int payloadlen, const void *payload, int qos,
+                      bool retain)
+{
+	if (bench_link == BENCH_LINK_FAILING) {
+		return MOSQ_ERR_NO_CONN;
+	}
+	count.pubs++;
+	count.bytes += strlen(topic) + payloadlen;
+	if (bench_link == BENCH_LINK_UP) {
+		pub_on_publish(mosq, NULL, 0);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+#ifdef WITH_MQTT5
+/* no connect announces an alias maximum, so every alias stays unused */
+int mosquitto_publish_v5(struct mosquitto *mosq, int *mid, const char *topic,
+                         int payloadlen, const void *payload, int qos,
+                         bool retain, const mosquitto_property *properties)
+{
+	return mosquitto_publish(mosq, mid, topic != NULL ? topic : "", payloadlen,
+	                         payload, qos, retain);
+}
+
+int mosquitto_property_add_int16(mosquitto_property **proplist,
+                                 int identifier, uint16_t value)
+{
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+const mosquitto_property *mosquitto_property_read_int16(
+	const mosquitto_property *proplist, int identifier, uint16_t *value,
+	bool skip_first)
+{
+	return NULL;
+}
+
+void mosquitto_property_free_all(mosquitto_property **properties)
+{
+}
+#endif
+
+int ubus_send_event(struct ubus_context *ctx, const char *id,
+                    struct blob_attr *data)
+{
+	count.events++;
+	return 0;
+}
+
+/* grows like libubox: one realloc per fresh buffer, then in 256 byte steps */
+static bool bench_blob_grow(struct blob_buf *buf, int minlen)
+{
+	int delta = minlen > 256 ? minlen : 256;
+	void *p = realloc(buf->buf, buf->buflen + delta);
+
+	if (p == NULL) {
+		return false;
+	}
+	buf->buf = p;
+	buf->buflen += delta;
+	return true;
+}
+
+int blob_buf_init(struct blob_buf *buf, int id)
+{
+	if (buf->buf == NULL && !bench_blob_grow(buf, 0)) {
+		return -1;
+	}
+	buf->head = buf->buf;
+	buf->head->id_len = htobe32(sizeof(struct blob_attr));
+	return 0;
+}
+
+void blob_buf_free(struct blob_buf *buf)
+{
+	free(buf->buf);
+	buf->buf = NULL;
+	buf->buflen = 0;
+}
+
+int blobmsg_add_field(struct blob_buf *buf, int type, const char *name,
+                      const void *data, unsigned int len)
+{
+	size_t used = be32toh(buf->head->id_len) & BLOB_ATTR_LEN_MASK;
+	size_t need = used + blobmsg_hdrlen(strlen(name)) + ((len + 3) & ~3);
+
+	if (need > buf->buflen && !bench_blob_grow(buf, need - buf->buflen)) {
+		return -1;
+	}
+	buf->head = buf->buf; /* no nesting, so the head is the buffer */
+	memcpy((char *)buf->head + used + blobmsg_hdrlen(strlen(name)), data, len);
+	buf->head->id_len = htobe32(need);
+	return 0;
+}
+
+int uci_lookup_ptr(struct uci_context *ctx, struct uci_ptr *ptr, char *str,
+                   bool extended)
+{
+	return UCI_ERR_NOTFOUND;
+}
+
+void uci_perror(struct uci_context *ctx, const char *str) {}
+int uci_set(struct uci_context *ctx, struct uci_ptr *ptr) { return 0; }
+int uci_save(struct uci_context *ctx, struct uci_package *p) { return 0; }
+int uci_commit(struct uci_context *ctx, struct uci_package **p,
+               bool overwrite) { return 0; }
+struct uci_context *uci_alloc_context(void) { return NULL; }
+void uci_free_context(struct uci_context *ctx) {}
+int uloop_fd_add(struct uloop_fd *sock, unsigned int flags) { return 0; }
+int uloop_fd_delete(struct uloop_fd *sock) { return 0; }
+int uloop_timeout_set(struct uloop_timeout *timeout, int msecs) { return 0; }
+int uloop_timeout_cancel(struct uloop_timeout *timeout) { return 0; }
+
+static long long bench_now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void bench_report(const char *name, long long nsec,
+                         unsigned long long n)
+{
+	fprintf(stdout, "%-22s %10.1f %9.2f %9.2f %9.2f %9.1f\n",
+	    name,
+	    (double)nsec / n,
+	    (double)count.allocs / n,
+	    (double)(count.allocs - count.frees) / n,
+	    (double)count.pubs / n,
+	    (double)count.bytes / n);
+}
+
+/* the snprintf formats the fmt based serializers replaced */
+#define BENCH_REF_WAVE "[[%d,%d],["\
+	"%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,"\
+	"%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld],\"%s\"]"
+#define BENCH_REF_COUNTER "[%d, %u, \"%s\"]"
+#define BENCH_REF_COUNTER_FRAC "[%d, %u.%03u, \"%s\"]"
+#define BENCH_REF_GAUGE "[%d, %d, \"%s\"]"
+#define BENCH_REF_GAUGE_FRAC "[%d, %d.%03u, \"%s\"]"
+
+static int bench_ref_wave(char *buf, uint32_t time, uint16_t millis,
+                          const int32_t *s, const char *unit)
+{
+	return snprintf(buf, DECODE_BUFFER_SIZE, BENCH_REF_WAVE, time, millis,
+	    (long)s[0], (long)s[1], (long)s[2], (long)s[3], (long)s[4],
+	    (long)s[5], (long)s[6], (long)s[7], (long)s[8], (long)s[9],
+	    (long)s[10], (long)s[11], (long)s[12], (long)s[13], (long)s[14],
+	    (long)s[15], (long)s[16], (long)s[17], (long)s[18], (long)s[19],
+	    (long)s[20], (long)s[21], (long)s[22], (long)s[23], (long)s[24],
+	    (long)s[25], (long)s[26], (long)s[27], (long)s[28], (long)s[29],
+	    (long)s[30], (long)s[31], unit);
+}
+
+static int bench_ref_reading(char *buf, uint32_t time, int32_t value,
+                             bool sign, uint16_t frac, const char *unit)
+{
+	if (sign) {
+		return frac == 0 ?
+		    snprintf(buf, CONFIG_STR_MAX, BENCH_REF_GAUGE, time, value, unit) :
+		    snprintf(buf, CONFIG_STR_MAX, BENCH_REF_GAUGE_FRAC, time, value,
+		             frac, unit);
+	}
+	return frac == 0 ?
+	    snprintf(buf, CONFIG_STR_MAX, BENCH_REF_COUNTER, time, (uint32_t)value,
+	             unit) :
+	    snprintf(buf, CONFIG_STR_MAX, BENCH_REF_COUNTER_FRAC, time,
+	             (uint32_t)value, frac, unit);
+}
+
+static uint32_t bench_rand32(void)
+{
+	uint32_t r = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+
+	/* favour short numbers and the edges as well as the full range */
+	switch (rand() % 4) {
+	case 0:
+		return r % 1000;
+	case 1:
+		return rand() % 2 ? 0x80000000UL : 0x7fffffffUL;
+	default:
+		return r;
+	}
+}
+
+/* the serializers have to match the snprintf output byte for byte */
+static bool bench_fmt_check(void)
+{
+	int i, j, len, ref_len;
+	int32_t s[DECODE_NUM_SAMPLES];
+	char buf[DECODE_BUFFER_SIZE], ref[DECODE_BUFFER_SIZE];
+	uint32_t time, value;
+	uint16_t frac;
+
+	srand(2);
+	for (i = 0; i < 20000; i++) {
+		for (j = 0; j < DECODE_NUM_SAMPLES; j++) {
+			s[j] = bench_rand32();
+		}
+		time = bench_rand32();
+		frac = rand() % 2 ? 0 : rand() % 65536;
+		len = decode_fmt_wave(buf, time, frac, s, "mV") - buf;
+		ref_len = bench_ref_wave(ref, time, frac, s, "mV");
+		if (len != ref_len || memcmp(buf, ref, len) != 0) {
+			fprintf(stderr, "fmt wave mismatch:\n%.*s\n%s\n", len, buf, ref);
+			return false;
+		}
+		value = bench_rand32();
+		for (j = 0; j < 2; j++) {
+			len = decode_fmt_reading(buf, time, value, j, frac, "VARh");
+			ref_len = bench_ref_reading(ref, time, value, j, frac, "VARh");
+			if (len != ref_len || memcmp(buf, ref, len) != 0) {
+				fprintf(stderr, "fmt reading mismatch:\n%.*s\n%s\n", len,
+				        buf, ref);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* reverse of decode_bin_wave(), returns the bytes consumed or -1 */
+static int bench_unwave(const unsigned char *p, uint32_t *time,
+                        uint16_t *millis, int32_t *s)
+{
+	int i, shift;
+	int64_t prev = 0;
+	uint64_t zz;
+	const unsigned char *start = p;
+	uint8_t format = *p++;
+
+	*time = decode_le32(p);
+	*millis = decode_le16(p + 4);
+	p += 6;
+	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+		if (format == CONFIG_WAVE_RAW) {
+			s[i] = (int32_t)decode_le32(p);
+			p += 4;
+			continue;
+		}
+		for (zz = 0, shift = 0; *p & 0x80; shift += 7) {
+			zz |= (uint64_t)(*p++ & 0x7f) << shift;
+		}
+		zz |= (uint64_t)*p++ << shift;
+		prev += (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+		s[i] = (int32_t)prev;
+	}
+	return format == CONFIG_WAVE_RAW || format == CONFIG_WAVE_DELTA ?
+	       p - start : -1;
+}
+
+static bool bench_wave_check(void)
+{
+	int i, j, len;
+	uint8_t format;
+	int32_t s[DECODE_NUM_SAMPLES], out[DECODE_NUM_SAMPLES];
+	unsigned char buf[DECODE_BUFFER_SIZE];
+	uint32_t time, t;
+	uint16_t millis, m;
+
+	srand(3);
+	for (i = 0; i < 20000; i++) {
+		for (j = 0; j < DECODE_NUM_SAMPLES; j++) {
+			s[j] = i % 2 ? bench_rand32() : rand() % 4096 - 2048;
+		}
+		time = bench_rand32();
+		millis = rand() % 1000;
+		for (format = CONFIG_WAVE_RAW; format <= CONFIG_WAVE_DELTA; format++) {
+			len = decode_bin_wave(buf, format, time, millis, s) - buf;
+			if (bench_unwave(buf, &t, &m, out) != len || t != time ||
+			    m != millis || memcmp(s, out, sizeof(s)) != 0) {
+				fprintf(stderr, "wave format %d mismatch\n", format);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * Single-threaded mode with a budget: libmosquitto reports a QoS 0 message
+ * from within mosquitto_publish(), so the backlog has to stay at zero
+ * rather than grow into shedding everything. Refused messages must not
+ * count either, and a reconnect forgets what a stalled link still held,
+ * but only on the connection that reconnected.
+ */
+static bool bench_budget_check(void)
+{
+	int i;
+	bool ok = true;
+
+	conf.single = true;
+	pub_configure(8);
+	for (i = 0; i < 1000 && ok; i++) {
+		ok = pub_publish_gauge("bench", 1, "0", 0, false);
+	}
+	bench_link = BENCH_LINK_FAILING;
+	for (i = 0; i < 100; i++) {
+		pub_publish_gauge("bench", 1, "0", 0, false);
+	}
+	bench_link = BENCH_LINK_UP;
+	for (i = 0; i < 100 && ok; i++) {
+		ok = pub_publish_gauge("bench", 1, "0", 0, false);
+	}
+	bench_link = BENCH_LINK_STALLED;
+	for (i = 0; i < 8 && ok; i++) {
+		ok = pub_publish_gauge("bench", 1, "0", 0, false);
+	}
+	ok = ok && !pub_publish_gauge("bench", 1, "0", 0, false);
+	bench_link = BENCH_LINK_UP;
+	pub_forget_pending(conf.mosq);
+	ok = ok && pub_publish_gauge("bench", 1, "0", 0, false);
+	/* split: a bulk reconnect leaves the data connection's backlog alone */
+	conf.mosq_bulk = (struct mosquitto *)&bench_link;
+	bench_link = BENCH_LINK_STALLED;
+	for (i = 0; i < 8 && ok; i++) {
+		ok = pub_publish("bench", 1, "0", 1, false);
+	}
+	pub_forget_pending(conf.mosq_bulk);
+	ok = ok && !pub_publish_gauge("bench", 1, "0", 0, false);
+	pub_forget_pending(conf.mosq);
+	bench_link = BENCH_LINK_UP;
+	ok = ok && pub_publish_gauge("bench", 1, "0", 0, false);
+	conf.mosq_bulk = NULL;
+	pub_configure(0);
+	conf.single = false;
+	count = (struct bench_count) { 0 };
+	if (!ok) {
+		fprintf(stderr, "publish backlog miscounted\n");
+	}
+	return ok;
+}
+
+/* place a telegram at the ring tail, as flx_pop() sees it after the sync */
+static void bench_frame(struct buffer_s *b, unsigned char type,
+                        const void *payload, size_t len)
+{
+	unsigned char telegram[ENCODE_SYNC_TL_LEN + 255 + ENCODE_FLETCHER16_LEN];
+	struct encode_s e = (struct encode_s) {
+		.type = type,
+		.data = payload,
+		.len = len
+	};
+
+	encode_handler(&e, telegram);
+	b->tail = b->size - 40; /* frames wrap around */
+	/* the mirror takes care of the wrap */
+	memcpy(&b->data[b->tail], telegram + 2, len + 4);
+	b->head = (b->tail + len + 4) & (b->size - 1);
+	b->state = FLX_BUFFER_STATE_HEAD;
+	flx_check_reset(b);
+}
+
+/* the byte at a time fletcher16 the streaming engine replaced */
+static uint16_t bench_fletcher16_ref(const unsigned char *data, size_t bytes)
+{
+	unsigned short sum1 = 0xff, sum2 = 0xff;
+
+	while (bytes) {
+		size_t tlen = bytes > 20 ? 20 : bytes;
+		bytes -= tlen;
+		do {
+			sum2 += sum1 += *data++;
+		} while (--tlen);
+		sum1 = (sum1 & 0xff) + (sum1 >> 8);
+		sum2 = (sum2 & 0xff) + (sum2 >> 8);
+	}
+	sum1 = (sum1 & 0xff) + (sum1 >> 8);
+	sum2 = (sum2 & 0xff) + (sum2 >> 8);
+	return sum2 << 8 | sum1;
+}
+
+/* feed random data in random pieces and compare with the reference */
+static bool bench_fletcher16_check(void)
+{
+	static unsigned char data[3 * FLETCHER16_BLOCK];
+	size_t i, len, done, piece;
+	struct fletcher16 f;
+
+	srand(1);
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = (i % 7 == 0) ? 0xff : rand();
+	}
+	for (len = 0; len <= sizeof(data); len += (len < 600) ? 1 : 997) {
+		fletcher16_init(&f);
+		for (done = 0; done < len; done += piece) {
+			piece = 1 + rand() % (len - done);
+			fletcher16_update(&f, data + done, piece);
+		}
+		if (fletcher16_final(&f) != bench_fletcher16_ref(data, len)) {
+			fprintf(stderr, "fletcher16 mismatch at %zu bytes\n", len);
+			return false;
+		}
+	}
+	return true;
+}
+
+static size_t bench_payload(unsigned char type, unsigned char *p)
+{
+	int i;
+	struct ct_data_s *ct = (struct ct_data_s *)p;
+	struct pulse_data_s *pulse = (struct pulse_data_s *)p;
+	struct voltage_s *v = (struct voltage_s *)p;
+	struct current_s *c = (struct current_s *)p;
+	struct sar_s *sar = (struct sar_s *)p;
+	struct sdadc_s *sdadc = (struct sdadc_s *)p;
+	uint32_t now = htole32(1500000000);
+
+	memset(p, 0, 255);
+	switch (type) {
+	case FLX_TYPE_PONG:
+		return 4;
+	case FLX_TYPE_TIME_STAMP:
+		memcpy(p, &now, sizeof(now));
+		return sizeof(now);
+	case FLX_TYPE_VOLTAGE:
+		v->time = now;
+		for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+			v->sample[i] = htole32(-325000 + i * 20000);
+		}
+		return sizeof(*v);
+	case FLX_TYPE_CURRENT:
+		c->time = now;
+		for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+			c->sample[i] = htole32(-7000 + i * 450);
+		}
+		return sizeof(*c);
+	case FLX_TYPE_CT_DATA:
+		ct->time = now;
+		for (i = 0; i <= DECODE_CT_PARAM_Q4; i++) {
+			ct->counter_integ[i] = htole32(123456 + i);
+			ct->counter_frac[i] = htole16(0x8000 + i);
+		}
+		for (i = 0; i < DECODE_MAX_CT_PARAMS; i++) {
+			ct->gauge[i] = htole32((230 << 11) + i * 100);
+		}
+		return sizeof(*ct);
+	case FLX_TYPE_PULSE_DATA:
+		pulse->time = now;
+		pulse->port = CONFIG_MAX_ANALOG_PORTS;
+		pulse->gauge = htole32(3 << 10);
+		pulse->counter_integ = htole32(4321);
+		pulse->counter_millis = htole16(250);
+		return sizeof(*pulse);
+	case FLX_TYPE_KUBE_PACKET:
+		for (i = 0; i < 7 + 32; i++) {
+			p[i] = i;
+		}
+		return 7 + 32;
+	case FLX_TYPE_SAR:
+		sar->time = now;
+		for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+			sar->adc[i] = htole16(2048 + i * 50);
+		}
+		return sizeof(*sar);
+	case FLX_TYPE_SDADC:
+		sdadc->time = now;
+		for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+			sdadc->adc[i] = htole16(-16000 + i * 1000);
+		}
+		return sizeof(*sdadc);
+	case FLX_TYPE_RFM:
+		return 32;
+	default:
+		return 0;
+	}
+}
+
+/* run fun until BENCH_MIN_NSEC has passed and report per iteration */
+#define BENCH(name, fun) do { \
+	unsigned long long n, iterations = BENCH_MIN_ITERATIONS; \
+	long long start, elapsed; \
+	for (;;) { \
+		memset(&count, 0, sizeof(count)); \
+		start = bench_now(); \
+		for (n = 0; n < iterations; n++) { \
+			fun; \
+		} \
+		elapsed = bench_now() - start; \
+		if (elapsed >= BENCH_MIN_NSEC) { \
+			break; \
+		} \
+		iterations *= 2; \
+	} \
+	bench_report(name, elapsed, iterations); \
+} while (0)
+
+static const char *bench_handler_name[] = {
+	"decode_ping",
+	"decode_pong",
+	"decode_port_config",
+	"decode_time_stamp",
+	"decode_time_step",
+	"decode_time_slew",
+	"decode_voltage",
+	"decode_current",
+	"decode_ct_data",
+	"decode_pulse_data",
+	"decode_kube_packet",
+	"decode_kube_ctrl",
+	"decode_debug",
+	"decode_debug_sar",
+	"decode_debug_sdadc",
+	"decode_debug_rfm",
+};
+
+static void bench_init(void)
+{
+	int i;
+
+	if (flx_init() < 0) {
+		exit(1);
+	}
+	conf.transport.fd = -1;
+	conf.transport.fd_hold = -1;
+	strcpy(conf.device, BENCH_DEVICE);
+	for (i = 0; i < CONFIG_MAX_SENSORS; i++) {
+		snprintf(conf.sensor[i].id, CONFIG_STR_MAX, "%032x", i);
+		conf.sensor[i].type = CONFIG_SENSOR_TYPE_ELECTRICITY;
+		conf.sensor[i].enable = 1;
+	}
+	decode_plan_build();
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char type;
+	size_t len;
+	struct decode_s d;
+	unsigned char payload[255];
+	unsigned char telegram[ENCODE_SYNC_TL_LEN + 255 + ENCODE_FLETCHER16_LEN];
+	unsigned char hex[2 * 255 + 1];
+	struct encode_s e;
+	struct buffer_s *b = &rx;
+	int i;
+	int32_t samples[DECODE_NUM_SAMPLES];
+	char buf[DECODE_BUFFER_SIZE];
+
+	bench_init();
+	if (!bench_fletcher16_check() || !bench_fmt_check() ||
+	    !bench_wave_check() || !bench_budget_check()) {
+		return 1;
+	}
+	fprintf(stdout, "%-22s %10s %9s %9s %9s %9s\n",
+	        "benchmark", "ns/frame", "allocs", "leaked", "pubs", "bytes");
+	for (type = 0; type < sizeof(decode_handler) / sizeof(decode_handler[0]);
+	     type++) {
+		if (decode_handler[type] == decode_void) {
+			continue;
+		}
+		len = bench_payload(type, payload);
+		bench_frame(b, type, payload, len);
+		BENCH(bench_handler_name[type], decode_handler[type](b, &d));
+	}
+
+	len = bench_payload(FLX_TYPE_VOLTAGE, payload);
+	bench_frame(b, FLX_TYPE_VOLTAGE, payload, len);
+	conf.wave = CONFIG_WAVE_RAW;
+	BENCH("decode_voltage raw", decode_voltage(b, &d));
+	conf.wave = CONFIG_WAVE_DELTA;
+	BENCH("decode_voltage delta", decode_voltage(b, &d));
+	conf.wave = CONFIG_WAVE_JSON;
+
+	len = bench_payload(FLX_TYPE_CT_DATA, payload);
+	bench_frame(b, FLX_TYPE_CT_DATA, payload, len);
+	conf.bundle = 1;
+	bundle_configure(conf.bundle);
+	BENCH("decode_ct_data bundled", decode_ct_data(b, &d));
+	bundle_flush();
+	conf.bundle = 0;
+	for (i = 0; i < DECODE_CT_SENSORS; i++) {
+		conf.sensor[i].window = 60;
+	}
+	decode_plan_build();
+	BENCH("decode_ct_data windowed", decode_ct_data(b, &d));
+	for (i = 0; i < DECODE_CT_SENSORS; i++) {
+		conf.sensor[i].window = 0;
+	}
+	decode_plan_build();
+	history_open("", HISTORY_SPAN_DEFAULT, HISTORY_STEP_DEFAULT);
+	BENCH("decode_ct_data history", decode_ct_data(b, &d));
+	history_close();
+	bench_frame(b, FLX_TYPE_CT_DATA, payload, len);
+	BENCH("fletcher16_ref", bench_sink = bench_fletcher16_ref(&b->data[b->tail],
+	      len + 2));
+	BENCH("flx_check_fletcher16", (flx_check_reset(b),
+	      bench_sink = flx_check_fletcher16(b)));
+	/* the common case, the payload was folded in while it arrived */
+	BENCH("fletcher16 at end", bench_sink = flx_check_fletcher16(b));
+
+	e = (struct encode_s) {
+		.type = FLX_TYPE_CT_DATA,
+		.data = payload,
+		.len = len
+	};
+	BENCH("encode_handler", (encode_handler(&e, telegram),
+	      bench_sink = telegram[len + 5]));
+
+	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+		samples[i] = -325000 + i * 20000;
+	}
+	BENCH("snprintf wave", bench_sink = bench_ref_wave(buf, 1500000000, 999,
+	      samples, "mV"));
+	BENCH("decode_fmt_wave", bench_sink = decode_fmt_wave(buf, 1500000000,
+	      999, samples, "mV") - buf);
+	BENCH("snprintf reading", bench_sink = bench_ref_reading(buf, 1500000000,
+	      -230, true, 500, "W"));
+	BENCH("decode_fmt_reading", bench_sink = decode_fmt_reading(buf,
+	      1500000000, -230, true, 500, "W"));
+
+	BENCH("hexlify", hexlify(payload, hex, 64));
+	BENCH("unhexlify", unhexlify(hex, payload, 128));
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <libubox/uloop.h>
+#include "bundle.h"
+#include "config.h"
+#include "fmt.h"
+#include "pub.h"
+#include "spool.h"
+
+struct bundle_buf {
+	bool open;
+	uint32_t window; /* start of the interval being gathered */
+	size_t len;
+	char data[BUNDLE_BUFFER_SIZE];
+	struct uloop_timeout timeout;
+};
+
+static struct {
+	unsigned int interval;
+	char topic[CONFIG_STR_MAX + 16];
+	struct bundle_buf buf[BUNDLE_KINDS];
+} bundle;
+
+/* counters go through the spool and are never shed, gauges may be */
+static void bundle_flush_kind(enum bundle_kind kind)
+{
+	struct bundle_buf *b = &bundle.buf[kind];
+
+	if (!b->open) {
+		return;
+	}
+	uloop_timeout_cancel(&b->timeout);
+	b->data[b->len - 1] = ']'; /* overwrites the trailing comma */
+	b->open = false;
+	if (kind == BUNDLE_GAUGES) {
+		pub_publish_gauge(bundle.topic, b->len, b->data, conf.mqtt.qos,
+		                  conf.mqtt.retain);
+		return;
+	}
+	if (spool_take(bundle.topic, b->data, b->len)) {
+		return;
+	}
+	pub_publish(bundle.topic, b->len, b->data, conf.mqtt.qos,
+	            conf.mqtt.retain);
+}
+
+static void bundle_timeout(struct uloop_timeout *t)
+{
+	struct bundle_buf *b = container_of(t, struct bundle_buf, timeout);
+
+	bundle_flush_kind(b - bundle.buf);
+}
+
+void bundle_configure(unsigned int interval)
+{
+	int kind;
+
+	bundle_flush();
+	bundle.interval = interval > BUNDLE_INTERVAL_MAX ?
+	                  BUNDLE_INTERVAL_MAX : interval;
+	snprintf(bundle.topic, sizeof(bundle.topic), BUNDLE_TOPIC, conf.device);
+	for (kind = 0; kind < BUNDLE_KINDS; kind++) {
+		bundle.buf[kind].timeout.cb = bundle_timeout;
+	}
+}
+
+void bundle_flush(void)
+{
+	int kind;
+
+	for (kind = 0; kind < BUNDLE_KINDS; kind++) {
+		bundle_flush_kind(kind);
+	}
+}
+
+void bundle_add(enum bundle_kind kind, const char *topic, uint32_t time,
+                const char *data, int len)
+{
+	char *p;
+	struct bundle_buf *b = &bundle.buf[kind];
+	uint32_t window = time - time % bundle.interval;
+	/* ["<topic>",<data>], */
+	size_t need = strlen(topic) + len + 6;
+
+	if (b->open && (window != b->window ||
+	                b->len + need > BUNDLE_BUFFER_SIZE)) {
+		bundle_flush_kind(kind);
+	}
+	if (!b->open) {
+		b->open = true;
+		b->window = window;
+		b->len = 1;
+		b->data[0] = '[';
+		/* flush at the end of the aligned window, not an interval later */
+		uloop_timeout_set(&b->timeout,
+		                  (window + bundle.interval - time) * 1000 +
+		                  BUNDLE_GRACE);
+	}
+	p = b->data + b->len;
+	p = fmt_str(p, "[\"");
+	p = fmt_str(p, topic);
+	p = fmt_str(p, "\",");
+	memcpy(p, data, len);
+	p = fmt_str(p + len, "],");
+	b->len = p - b->data;
+}
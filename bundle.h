@@ -0,0 +1,30 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+
+/*
+ * Bundle mode gathers the sensor readings of one interval into messages
+ * on /device/<device>/bundle, each a JSON array of [topic, payload] pairs
+ * where each pair is exactly what would otherwise have been published on
+ * its own. Counters and gauges are bundled apart, so the gauge bundle can
+ * be shed under flx.main.budget like single gauges while the counter
+ * bundle is spooled like single counters.
+ */
+#define BUNDLE_TOPIC			"/device/%s/bundle"
+#define BUNDLE_BUFFER_SIZE		8192
+#define BUNDLE_INTERVAL_MAX		60 /* s */
+#define BUNDLE_GRACE			500 /* ms after the window before flushing */
+
+enum bundle_kind {
+	BUNDLE_COUNTERS,
+	BUNDLE_GAUGES,
+	BUNDLE_KINDS
+};
+
+void bundle_configure(unsigned int interval);
+void bundle_add(enum bundle_kind kind, const char *topic, uint32_t time,
+                const char *data, int len);
+void bundle_flush(void);
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <libubox/uloop.h>
+#include "capture.h"
+#include "config.h"
+#include "flx.h"
+
+static FILE *capture;
+
+static struct {
+	FILE *file;
+	unsigned int pace;
+	struct timeval first; /* timestamp of the first record */
+	struct timeval start; /* wall clock when replay started */
+	size_t len;
+	unsigned char data[CAPTURE_RECORD_MAX];
+	struct uloop_timeout timeout;
+} replay;
+
+static void capture_put_le(unsigned char *p, uint32_t value, int bytes)
+{
+	int i;
+
+	for (i = 0; i < bytes; i++) {
+		p[i] = (value >> (8 * i)) & 0xff;
+	}
+}
+
+static uint32_t capture_get_le(const unsigned char *p, int bytes)
+{
+	int i;
+	uint32_t value = 0;
+
+	for (i = 0; i < bytes; i++) {
+		value |= (uint32_t)p[i] << (8 * i);
+	}
+	return value;
+}
+
+bool capture_open(const char *path)
+{
+	capture = fopen(path, "wb");
+	if (capture == NULL) {
+		perror(path);
+		return false;
+	}
+	if (fwrite(CAPTURE_MAGIC, CAPTURE_MAGIC_LEN, 1, capture) != 1) {
+		perror(path);
+		capture_close();
+		return false;
+	}
+	return true;
+}
+
+void capture_write(const unsigned char *data, size_t len)
+{
+	struct timeval t;
+	unsigned char hdr[CAPTURE_RECORD_HDR_LEN];
+
+	if (capture == NULL || len == 0 || len > CAPTURE_RECORD_MAX) {
+		return;
+	}
+	gettimeofday(&t, NULL);
+	capture_put_le(hdr, t.tv_sec, 4);
+	capture_put_le(hdr + 4, t.tv_usec, 4);
+	capture_put_le(hdr + 8, len, 2);
+	if (fwrite(hdr, sizeof(hdr), 1, capture) != 1 ||
+	    fwrite(data, len, 1, capture) != 1) {
+		perror("[capture] write");
+		capture_close();
+	}
+}
+
+void capture_close(void)
+{
+	if (capture != NULL) {
+		fclose(capture);
+		capture = NULL;
+	}
+}
+
+static bool capture_replay_read(struct timeval *t)
+{
+	unsigned char hdr[CAPTURE_RECORD_HDR_LEN];
+
+	if (fread(hdr, sizeof(hdr), 1, replay.file) != 1) {
+		return false;
+	}
+	t->tv_sec = capture_get_le(hdr, 4);
+	t->tv_usec = capture_get_le(hdr + 4, 4);
+	replay.len = capture_get_le(hdr + 8, 2);
+	return fread(replay.data, replay.len, 1, replay.file) == 1;
+}
+
+/* milliseconds until the pending record with timestamp t is due */
+static int capture_replay_delay(struct timeval *t)
+{
+	long long recorded, elapsed;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	recorded = (t->tv_sec - replay.first.tv_sec) * 1000LL +
+	           (t->tv_usec - replay.first.tv_usec) / 1000;
+	elapsed = (now.tv_sec - replay.start.tv_sec) * 1000LL +
+	          (now.tv_usec - replay.start.tv_usec) / 1000;
+	return recorded / replay.pace > elapsed ?
+	       recorded / replay.pace - elapsed : 0;
+}
+
+static void capture_replay_cb(struct uloop_timeout *timeout)
+{
+	int i, delay;
+	struct timeval t;
+
+	/* there is always a record pending when we get here */
+	for (i = 0; i < CAPTURE_REPLAY_BATCH; i++) {
+		flx_feed(replay.data, replay.len);
+		if (!capture_replay_read(&t)) {
+			if (conf.verbosity > 0) {
+				fprintf(stdout, "[capture] end of replay\n");
+			}
+			uloop_end();
+			return;
+		}
+		if (replay.pace > 0 && (delay = capture_replay_delay(&t)) > 0) {
+			uloop_timeout_set(timeout, delay);
+			return;
+		}
+	}
+	/* yield to ubus and mosquitto before the next batch */
+	uloop_timeout_set(timeout, 0);
+}
+
+bool capture_replay_start(int fd, unsigned int pace)
+{
+	char magic[CAPTURE_MAGIC_LEN];
+
+	/* the transport keeps ownership of fd */
+	replay.file = fdopen(dup(fd), "rb");
+	if (replay.file == NULL) {
+		perror("[capture] replay");
+		return false;
+	}
+	if (fread(magic, sizeof(magic), 1, replay.file) != 1 ||
+	    memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0) {
+		fprintf(stderr, "[capture] not a capture file\n");
+		return false;
+	}
+	if (!capture_replay_read(&replay.first)) {
+		fprintf(stderr, "[capture] empty capture file\n");
+		return false;
+	}
+	replay.pace = pace;
+	gettimeofday(&replay.start, NULL);
+	replay.timeout.cb = capture_replay_cb;
+	uloop_timeout_set(&replay.timeout, 0);
+	return true;
+}
+
+void capture_replay_stop(void)
+{
+	uloop_timeout_cancel(&replay.timeout);
+	if (replay.file != NULL) {
+		fclose(replay.file);
+		replay.file = NULL;
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A capture file starts with CAPTURE_MAGIC, followed by one record per
+ * read() on the transport: le32 seconds, le32 microseconds, le16 length
+ * and the raw bytes. Fields are little-endian so that captures taken on
+ * the meter can be replayed on any build box.
+ */
+#define CAPTURE_MAGIC				"FLXCAP01"
+#define CAPTURE_MAGIC_LEN			8
+#define CAPTURE_RECORD_HDR_LEN		10
+#define CAPTURE_RECORD_MAX			65535
+#define CAPTURE_REPLAY_BATCH		64 /* records per uloop pass at max speed */
+#define CAPTURE_PACE_DEFAULT		1
+
+bool capture_open(const char *path);
+void capture_write(const unsigned char *data, size_t len);
+void capture_close(void);
+bool capture_replay_start(int fd, unsigned int pace);
+void capture_replay_stop(void);
+
+#endif
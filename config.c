@@ -24,14 +24,25 @@
 
 #include <json/json.h>
 #include "math.h"
+#include "bundle.h"
+#include "pub.h"
 #include "config.h"
 #include "flx.h"
+#include "history.h"
+#include "latest.h"
 #include "spin.h"
+#include "spool.h"
+#include "stream.h"
 
 const char* config_uci_sensor_tpl[] = {
 	"flukso.%d.id",
 	"flukso.%d.type",
 	"flukso.%d.enable",
+	"flukso.%d.deadband",
+	"flukso.%d.deadband_rel",
+	"flukso.%d.heartbeat",
+	"flukso.%d.window",
+	"flukso.%d.interval",
 };
 
 const char* config_uci_port_tpl[] = {
@@ -50,19 +61,24 @@ bool config_init(void)
 	return (conf.uci_ctx = uci_alloc_context()) ? true : false;
 }
 
-static bool config_load_str(char *key, char *value)
+/* an optional key that is missing quietly leaves its default in place */
+static bool config_lookup(char *key, char *value, bool optional)
 {
 	struct uci_ptr ptr;
 	char str[CONFIG_STR_MAX];
 
 	strncpy(str, key, CONFIG_STR_MAX);
 	if (uci_lookup_ptr(conf.uci_ctx, &ptr, str, true) != UCI_OK) {
-		uci_perror(conf.uci_ctx, key);
+		if (!optional || conf.uci_ctx->err != UCI_ERR_NOTFOUND) {
+			uci_perror(conf.uci_ctx, key);
+		}
 		return false;
 	}
 	if (!(ptr.flags & UCI_LOOKUP_COMPLETE)) {
-		conf.uci_ctx->err = UCI_ERR_NOTFOUND;
-		uci_perror(conf.uci_ctx, key);
+		if (!optional) {
+			conf.uci_ctx->err = UCI_ERR_NOTFOUND;
+			uci_perror(conf.uci_ctx, key);
+		}
 		return false;
 	}
 	strncpy(value, ptr.o->v.string, CONFIG_STR_MAX);
@@ -72,6 +88,16 @@ static bool config_load_str(char *key, char *value)
 	return true;
 }
 
+static bool config_load_str(char *key, char *value)
+{
+	return config_lookup(key, value, false);
+}
+
+static bool config_load_opt_str(char *key, char *value)
+{
+	return config_lookup(key, value, true);
+}
+
 static uint32_t config_load_uint(char *key, uint32_t def)
 {
 	char str_value[CONFIG_STR_MAX];
@@ -82,6 +108,16 @@ static uint32_t config_load_uint(char *key, uint32_t def)
 	return strtoul(str_value, (char **)NULL, 10);
 }
 
+static uint32_t config_load_opt_uint(char *key, uint32_t def)
+{
+	char str_value[CONFIG_STR_MAX];
+
+	if (!config_load_opt_str(key, str_value)) {
+		return def;
+	}
+	return strtoul(str_value, (char **)NULL, 10);
+}
+
 static double config_load_fp(char *key, double def)
 {
 	char str_value[CONFIG_STR_MAX];
@@ -92,6 +128,38 @@ static double config_load_fp(char *key, double def)
 	return atof(str_value);
 }
 
+static double config_load_opt_fp(char *key, double def)
+{
+	char str_value[CONFIG_STR_MAX];
+
+	if (!config_load_opt_str(key, str_value)) {
+		return def;
+	}
+	return atof(str_value);
+}
+
+void config_load_transport(char *spec)
+{
+	if (!config_load_opt_str(CONFIG_UCI_TRANSPORT, spec)) {
+		strcpy(spec, FLX_DEV);
+	}
+}
+
+unsigned int config_load_latency(void)
+{
+	return config_load_opt_uint(CONFIG_UCI_LATENCY, 0);
+}
+
+bool config_load_single(void)
+{
+	return config_load_opt_uint(CONFIG_UCI_SINGLE, 0) != 0;
+}
+
+bool config_load_split(void)
+{
+	return config_load_opt_uint(CONFIG_UCI_SPLIT, 0) != 0;
+}
+
 static uint8_t config_type_to_index(char *type)
 {
 	if (strcmp("electricity", type) == 0) {
@@ -140,6 +208,25 @@ static bool config_load_sensor(int sensor)
 		case 2:
 			conf.sensor[sensor].enable = (uint8_t)config_load_uint(key, 0);
 			break;
+		case 3:
+			/* in the reading's unit, e.g. W for a gauge */
+			conf.sensor[sensor].deadband =
+			    (uint32_t)(config_load_opt_fp(key, 0.0) * 1e3);
+			break;
+		case 4:
+			/* in percent of the last published gauge */
+			conf.sensor[sensor].deadband_rel =
+			    (uint32_t)(config_load_opt_fp(key, 0.0) * 1e4);
+			break;
+		case 5:
+			conf.sensor[sensor].heartbeat = config_load_opt_uint(key, 0);
+			break;
+		case 6:
+			conf.sensor[sensor].window = config_load_opt_uint(key, 0);
+			break;
+		case 7:
+			conf.sensor[sensor].interval = config_load_opt_uint(key, 0);
+			break;
 		}
 	}
 	return true;
@@ -256,6 +343,63 @@ static void config_load_batch(void)
 	}
 }
 
+static void config_load_bundle(void)
+{
+	conf.bundle = config_load_opt_uint(CONFIG_UCI_BUNDLE, 0);
+	bundle_configure(conf.bundle);
+}
+
+static void config_load_budget(void)
+{
+	pub_configure(config_load_opt_uint(CONFIG_UCI_BUDGET, 0));
+	conf.mqtt.inflight = config_load_opt_uint(CONFIG_UCI_INFLIGHT, 0);
+}
+
+/* without a spool path, counters are published or lost like the rest */
+static void config_load_spool(void)
+{
+	char path[CONFIG_STR_MAX];
+
+	if (config_load_opt_str(CONFIG_UCI_SPOOL, path) && path[0] != '\0') {
+		spool_open(path, config_load_opt_uint(CONFIG_UCI_SPOOL_SIZE,
+		                                      SPOOL_SIZE_DEFAULT));
+	} else {
+		spool_close();
+	}
+}
+
+/* after the decode plan, history is only kept for what it publishes */
+static void config_load_history(void)
+{
+	char path[CONFIG_STR_MAX] = "";
+
+	config_load_opt_str(CONFIG_UCI_HISTORY_FILE, path);
+	history_open(path, config_load_opt_uint(CONFIG_UCI_HISTORY, 0),
+	             config_load_opt_uint(CONFIG_UCI_HISTORY_STEP,
+	                                  HISTORY_STEP_DEFAULT));
+}
+
+/* a path under /dev/shm for the latest readings, see latest.h */
+static void config_load_latest(void)
+{
+	char path[CONFIG_STR_MAX];
+
+	if (config_load_opt_str(CONFIG_UCI_LATEST, path) && path[0] != '\0') {
+		latest_open(path);
+	} else {
+		latest_close();
+	}
+}
+
+/* the socket for local binary subscribers, see stream.h */
+static void config_load_stream(void)
+{
+	char path[CONFIG_STR_MAX] = "";
+
+	config_load_opt_str(CONFIG_UCI_STREAM, path);
+	stream_configure(path);
+}
+
 static uint8_t config_math_to_index(char *math)
 {
 	if (strcmp("p2+p1", math) == 0) {
@@ -280,6 +424,25 @@ static void config_load_math(void)
 #endif
 }
 
+static uint8_t config_wave_to_index(char *wave)
+{
+	if (strcmp("raw", wave) == 0) {
+		return CONFIG_WAVE_RAW;
+	} else if (strcmp("delta", wave) == 0) {
+		return CONFIG_WAVE_DELTA;
+	} else {
+		return CONFIG_WAVE_JSON;
+	}
+}
+
+static void config_load_wave(void)
+{
+	char wave[CONFIG_STR_MAX];
+
+	conf.wave = config_load_opt_str(CONFIG_UCI_WAVE, wave) ?
+		config_wave_to_index(wave) : CONFIG_WAVE_JSON;
+}
+
 void config_push(void)
 {
 	flx_tx(FLX_TYPE_PORT_CONFIG, (unsigned char *)&conf.port,
@@ -344,6 +507,7 @@ bool config_load_all(void)
 			return false;
 		}
 	}
+	flx_load_plan();
 	for (i = 0; i < CONFIG_MAX_PORTS; i++) {
 		config_load_port(i);
 	}
@@ -353,6 +517,13 @@ bool config_load_all(void)
 #endif
 	config_load_batch();
 	config_load_math();
+	config_load_spool();
+	config_load_history();
+	config_load_latest();
+	config_load_stream();
+	config_load_bundle();
+	config_load_budget();
+	config_load_wave();
 	config_push();
 	spin(SPIN_100K_CYCLES);
 	config_load_kube();
@@ -8,11 +8,12 @@
 #ifdef WITH_YKW
 #include <ykw.h>
 #endif
+#include "transport.h"
 
 #define CONFIG_MAX_PORTS			7
 #define CONFIG_MAX_ANALOG_PORTS		3
 #define CONFIG_MAX_PORT_PARAMS		5
-#define CONFIG_MAX_SENSOR_PARAMS	3
+#define CONFIG_MAX_SENSOR_PARAMS	8
 #define CONFIG_STR_MAX				64
 #define CONFIG_MAX_SENSORS			39
 #define CONFIG_UCI_DEVICE			"system.@system[0].device"
@@ -22,19 +23,40 @@
 #define CONFIG_UCI_MATH				"flx.main.math"
 #define CONFIG_UCI_THETA			"ykw.param.theta"
 #define CONFIG_UCI_COLLECT_GRP		"kube.main.collect_group"
+#define CONFIG_UCI_TRANSPORT		"flx.main.transport"
+#define CONFIG_UCI_LATENCY			"flx.main.latency"
+#define CONFIG_UCI_BUNDLE			"flx.main.bundle"
+#define CONFIG_UCI_WAVE				"flx.main.wave"
+#define CONFIG_UCI_SINGLE			"flx.main.single"
+#define CONFIG_UCI_SPLIT			"flx.main.split"
+#define CONFIG_UCI_BUDGET			"flx.main.budget"
+#define CONFIG_UCI_INFLIGHT			"flx.main.inflight"
+#define CONFIG_UCI_SPOOL			"flx.main.spool"
+#define CONFIG_UCI_SPOOL_SIZE		"flx.main.spool_size"
+#define CONFIG_UCI_HISTORY			"flx.main.history"
+#define CONFIG_UCI_HISTORY_STEP		"flx.main.history_step"
+#define CONFIG_UCI_HISTORY_FILE		"flx.main.history_file"
+#define CONFIG_UCI_LATEST			"flx.main.latest"
+#define CONFIG_UCI_STREAM			"flx.main.stream"
 #define CONFIG_ULOOP_TIMEOUT		1000 /* ms */
 #define CONFIG_UBUS_EV_SIGHUP		"flukso.sighup"
 #define CONFIG_UBUS_EV_SHIFT_CALC	"flx.shift.calc"
 #define CONFIG_UBUS_EV_KUBE_CTRL	"flukso.kube.ctrl"
 #define CONFIG_UBUS_EV_KUBE_PKT_TX	"flukso.kube.packet.tx"
 #define CONFIG_UBUS_DEBUG			"[ubus] rx %s event\n"
+#define CONFIG_UBUS_OBJECT			"flx"
 #define CONFIG_LED_MODE_DEFAULT		255
 #define CONFIG_COLLECT_GRP_DEFAULT	212
 #define CONFIG_TOPIC_BRIDGE_STAT	"$SYS/broker/connection/flukso-%.6s.flukso/state"
 #define CONFIG_GLOBE_LED_PATH		"/sys/class/leds/globe/brightness"
 
 #define CONFIG_MQTT_ID_TPL			"flxd-p%d"
-#define CONFIG_MQTT_ID_LEN			16
+#define CONFIG_MQTT_ID_DATA_TPL		"flxd-%.12s" /* device */
+#define CONFIG_MQTT_ID_BULK_TPL		"flxd-p%d-bulk"
+#define CONFIG_MQTT_ID_LEN			24
+#define CONFIG_MQTT_DATA_QOS		1 /* readings when split from bulk */
+#define CONFIG_MQTT_MISC_TIMEOUT	1000 /* ms, keepalive and reconnect */
+#define CONFIG_MQTT_CLOSE_TIMEOUT	100 /* ms to write out the DISCONNECT */
 
 #define ltobs(A) ((((uint16_t)(A) & 0xff00) >> 8) | \
 	              (((uint16_t)(A) & 0x00ff) << 8))
@@ -77,6 +99,13 @@ enum {
 	CONFIG_MATH_P1_PLUS_P2_PLUS_P3
 };
 
+/* payload of the /device/<id>/flx/<waveform> topics */
+enum {
+	CONFIG_WAVE_JSON,
+	CONFIG_WAVE_RAW,
+	CONFIG_WAVE_DELTA
+};
+
 enum {
 	CONFIG_TRIGGER_EDGE,
 	CONFIG_TRIGGER_LEVEL
@@ -90,12 +119,19 @@ struct mqtt {
 	bool clean_session;
 	int qos;
 	int retain;
+	unsigned int inflight; /* QoS > 0 window, 0 for the libmosquitto default */
 };
 
 struct sensor {
 	char id[CONFIG_STR_MAX];
 	uint8_t type;
 	uint8_t enable;
+	/* deadband, without a heartbeat a reading may be held indefinitely */
+	uint32_t deadband; /* 1/1000 of the reading's unit */
+	uint32_t deadband_rel; /* ppm of the last published gauge */
+	uint32_t heartbeat; /* s of silence before republishing regardless */
+	uint32_t window; /* s, publish gauge statistics instead of each reading */
+	uint32_t interval; /* s, publish counter deltas instead of each reading */
 };
 
 struct port {
@@ -129,7 +165,13 @@ struct config {
 	struct main main;
 	struct kube kube;
 	struct uci_context *uci_ctx;
+	struct transport transport;
 	struct uloop_fd flx_ufd;
+	unsigned int flx_latency; /* ms to coalesce rx wakeups, 0 to disable */
+	unsigned int bundle; /* s per bundled sensor publish, 0 to disable */
+	uint8_t wave; /* CONFIG_WAVE_* */
+	bool single; /* drive mosquitto from uloop instead of its own thread */
+	bool split; /* waveforms on their own connection, conf.mosq_bulk */
 	struct uloop_timeout timeout;
 	struct ubus_context *ubus_ctx;
 	struct ubus_event_handler ubus_ev_sighup;
@@ -138,6 +180,7 @@ struct config {
 	struct ubus_event_handler ubus_ev_kube_packet_tx;
 	struct mqtt mqtt;
 	struct mosquitto *mosq;
+	struct mosquitto *mosq_bulk; /* NULL unless split */
 #ifdef WITH_YKW
 	int theta;
 	unsigned int enabled;
@@ -150,6 +193,10 @@ struct config {
 extern struct config conf;
 
 bool config_init(void);
+void config_load_transport(char *spec);
+unsigned int config_load_latency(void);
+bool config_load_single(void);
+bool config_load_split(void);
 bool config_load_all(void);
 void config_push(void);
 void config_push_kube(void);
@@ -28,7 +28,6 @@
 #define DECODE_BUFFER_SIZE 1024
 #define DECODE_MAX_TELEGRAM_PAYLOAD_SIZE 256
 #define DECODE_TS_THRESHOLD 1234567890
-#define DECODE_KUBE_MAX_PACKET_SIZE (64 + 5)
 
 #define DECODE_TOPIC_SAR "/device/%s/flx/sar/%d"
 #define DECODE_TOPIC_SDADC "/device/%s/flx/sdadc/%d"
@@ -37,29 +36,30 @@
 #define DECODE_TOPIC_TIME "/device/%s/flx/time"
 #define DECODE_TOPIC_COUNTER "/sensor/%s/counter"
 #define DECODE_TOPIC_GAUGE "/sensor/%s/gauge"
+#define DECODE_TOPIC_STATS "/sensor/%s/stats"
+#define DECODE_TOPIC_INTERVAL "/sensor/%s/interval"
 
-#define DECODE_NUM_SAMPLES 32
-#define DECODE_SAR "[[%d,%d],["\
-	"%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,"\
-	"%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu,%hu],\"\"]"
-#define DECODE_SDADC "[[%d,%d],["\
-	"%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,"\
-	"%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd],\"\"]"
-#define DECODE_VOLTAGE "[[%d,%d],["\
-	"%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,"\
-	"%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld],\"mV\"]"
-#define DECODE_CURRENT "[[%d,%d],["\
-	"%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,"\
-	"%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld],\"mA\"]"
+#define DECODE_UNIT_SAR ""
+#define DECODE_UNIT_SDADC ""
+#define DECODE_UNIT_VOLTAGE "mV"
+#define DECODE_UNIT_CURRENT "mA"
 #define DECODE_TIME "{flm:{time:[%d,%d],update:%s},flx:{time:[%d,%d],update:%s}}"
-#define DECODE_COUNTER "[%d, %u, \"%s\"]"
-#define DECODE_COUNTER_FRAC "[%d, %u.%03u, \"%s\"]"
-#define DECODE_GAUGE "[%d, %d, \"%s\"]"
-#define DECODE_GAUGE_FRAC "[%d, %d.%03u, \"%s\"]"
+#define DECODE_FRAC_DIGITS 3
 #define DECODE_11BIT_FRAC_MASK 0x000007FFUL
 #define DECODE_20BIT_INTEG_MASK 0x7FFFF800UL
 #define DECODE_SIGN_MASK 0x80000000UL
 
+/* the ct ports own 12 sensors each, every pulse port after them owns one */
+#define DECODE_CT_SENSORS (CONFIG_MAX_ANALOG_PORTS * DECODE_MAX_CT_PARAMS)
+#define DECODE_PULSE_SENSOR(port) \
+	(DECODE_CT_SENSORS + (port) - CONFIG_MAX_ANALOG_PORTS)
+#define DECODE_PLAN_PORTS \
+	(CONFIG_MAX_ANALOG_PORTS + CONFIG_MAX_SENSORS - DECODE_CT_SENSORS)
+#define DECODE_PLAN_MAX (DECODE_CT_PARAM_Q4 + 1 + DECODE_MAX_CT_PARAMS)
+#define DECODE_PLAN_TOPIC_MAX (CONFIG_STR_MAX + 16) /* /sensor/<id>/counter */
+#define DECODE_STATS_MAX 128 /* [[start,window],[min,mean,max,last],"unit"] */
+#define DECODE_COUNTER_FIXED(integ, frac16) ((uint64_t)(integ) << 16 | (frac16))
+
 #define DECODE_UBUS_PATH_KUBE_PACKET	"flukso.kube.packet.rx"
 #define DECODE_UBUS_PATH_RFM_DEBUG		"flukso.rfm.debug"
 
@@ -77,21 +77,6 @@ struct decode_s {
 	size_t len;
 };
 
-enum decode_ct_params {
-	DECODE_CT_PARAM_PPLUS,
-	DECODE_CT_PARAM_PMINUS,
-	DECODE_CT_PARAM_Q1,
-	DECODE_CT_PARAM_Q2,
-	DECODE_CT_PARAM_Q3,
-	DECODE_CT_PARAM_Q4,
-	DECODE_CT_PARAM_VRMS,
-	DECODE_CT_PARAM_IRMS,
-	DECODE_CT_PARAM_PF,
-	DECODE_CT_PARAM_VTHD,
-	DECODE_CT_PARAM_ITHD,
-	DECODE_CT_PARAM_ALPHA,
-	DECODE_MAX_CT_PARAMS
-};
 
 const char *decode_ct_counter_unit[DECODE_CT_PARAM_Q4 + 1] = {
 	"Wh",
@@ -139,74 +124,62 @@ const char *decode_pulse_gauge_unit[CONFIG_SENSOR_MAX_TYPES] = {
 	"1/s"
 };
 
-const float decode_pulse_gauge_factor[CONFIG_SENSOR_MAX_TYPES] = {
-	3.6e3f,
-	3.6e3f,
-	1.0f,
-	1.0f,
-	1.0f,
-	1.0f,
-	1.0f,
-	1.0f
-};
-
-struct ct_data_s {
-	uint32_t time;
-	uint16_t millis;
-	uint8_t port;
-	uint8_t padding;
-	uint32_t counter_integ[DECODE_CT_PARAM_Q4 + 1];
-	uint16_t counter_frac[DECODE_CT_PARAM_Q4 + 1];
-	int32_t gauge[DECODE_MAX_CT_PARAMS];
-};
-
-struct pulse_data_s {
-	uint32_t time;
-	uint16_t millis;
-	uint8_t port;
-	uint8_t padding;
-	int32_t gauge; /* q20.11 */
-	uint32_t counter_integ;
-	uint16_t counter_millis;
+const uint16_t decode_pulse_gauge_factor[CONFIG_SENSOR_MAX_TYPES] = {
+	3600,
+	3600,
+	1,
+	1,
+	1,
+	1,
+	1,
+	1
 };
 
-struct kube_packet_s {
-	uint32_t time;
-	uint16_t millis;
-	uint8_t rssi;
-	uint8_t packet[DECODE_KUBE_MAX_PACKET_SIZE];
+enum decode_kind {
+	DECODE_KIND_COUNTER,
+	DECODE_KIND_GAUGE
 };
 
-struct sar_s {
-	uint32_t time;
-	uint16_t millis;
-	uint16_t adc[DECODE_NUM_SAMPLES];
+/*
+ * Publish plan, rebuilt from the sensor config by decode_plan_build(). The
+ * entries hold only what the per-telegram path reads. The topic strings are
+ * formatted once into decode_plan_topic, away from the hot fields.
+ */
+struct decode_plan_entry {
+	uint8_t kind;
+	uint8_t param; /* index into the ct telegram's counter or gauge array */
+	uint8_t sensor; /* index into conf.sensor */
+	uint16_t factor; /* pulse gauge unit factor */
+	uint16_t alias; /* dense over the plan, see decode_plan_alias() */
+	const char *unit;
+	const char *topic;
+	/* deadband state, reset whenever the plan is rebuilt */
+	bool published;
+	uint32_t last_time;
+	int64_t last;
+	/* gauge window, all values in 1/1000 of the unit */
+	uint32_t win_start;
+	uint32_t win_count;
+	int64_t win_min;
+	int64_t win_max;
+	int64_t win_sum;
+	int64_t win_last;
+	/* counter interval, snapshot in 1/65536 of the unit */
+	bool iv_open;
+	bool iv_partial;
+	uint32_t iv_start;
+	uint64_t iv_snap;
 };
 
-struct sdadc_s {
-	uint32_t time;
-	uint16_t millis;
-	uint8_t index;
-	uint8_t padding;
-	int16_t adc[DECODE_NUM_SAMPLES];
+struct decode_plan {
+	uint8_t len;
+	struct decode_plan_entry entry[DECODE_PLAN_MAX];
 };
 
-struct voltage_s {
-	uint32_t time;
-	uint16_t millis;
-	uint16_t padding;
-	int32_t rms;
-	int32_t sample[DECODE_NUM_SAMPLES];
-};
-
-struct current_s {
-	uint32_t time;
-	uint16_t millis;
-	uint8_t index;
-	uint8_t padding;
-	int32_t rms;
-	int32_t sample[DECODE_NUM_SAMPLES];
-};
+static struct decode_plan decode_plan[DECODE_PLAN_PORTS];
+static unsigned long long decode_held; /* readings inside a deadband */
+static char decode_plan_topic[DECODE_PLAN_PORTS][DECODE_PLAN_MAX]
+                             [DECODE_PLAN_TOPIC_MAX];
 
 typedef bool (*decode_fun)(struct buffer_s *, struct decode_s *);
 
@@ -215,16 +188,184 @@ static bool decode_void(struct buffer_s *b, struct decode_s *d)
 	return false;
 }
 
-static int decode_memcpy(struct buffer_s *b, unsigned char *sink)
+/* the frame is contiguous in the mirrored ring, so read the payload in place */
+static inline const unsigned char *decode_payload(struct buffer_s *b)
+{
+	return &b->data[b->tail + 2];
+}
+
+static inline size_t decode_payload_len(struct buffer_s *b)
+{
+	return b->data[b->tail + 1];
+}
+
+static inline uint16_t decode_le16(const unsigned char *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t decode_le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+	       (uint32_t)p[3] << 24;
+}
+
+#define DECODE_LE16(p, s, f) decode_le16((p) + offsetof(struct s, f))
+#define DECODE_LE32(p, s, f) decode_le32((p) + offsetof(struct s, f))
+#define DECODE_U8(p, s, f) (*((p) + offsetof(struct s, f)))
+
+/* [[time,millis],[s0,s1,...,s31],"unit"] */
+static char *decode_fmt_wave(char *p, uint32_t time, uint16_t millis,
+                             const int32_t *sample, const char *unit)
+{
+	int i;
+
+	p = fmt_str(p, "[[");
+	p = fmt_i32(p, (int32_t)time);
+	p = fmt_chr(p, ',');
+	p = fmt_u32(p, millis);
+	p = fmt_str(p, "],[");
+	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+		p = fmt_i32(p, sample[i]);
+		p = fmt_chr(p, ',');
+	}
+	p = fmt_str(p - 1, "],\"");
+	p = fmt_str(p, unit);
+	return fmt_str(p, "\"]");
+}
+
+/*
+ * Binary waveforms, selected with flx.main.wave:
+ *   u8 format (CONFIG_WAVE_RAW or CONFIG_WAVE_DELTA), u32 time, u16 millis
+ * all little-endian, followed by the DECODE_NUM_SAMPLES samples as
+ *   raw: i32 each
+ *   delta: zigzag varint of the difference with the previous sample (from 0)
+ */
+static inline unsigned char *decode_put_le(unsigned char *p, uint32_t v,
+                                           int bytes)
+{
+	for (; bytes > 0; bytes--, v >>= 8) {
+		*p++ = (unsigned char)v;
+	}
+	return p;
+}
+
+static unsigned char *decode_bin_wave(unsigned char *p, uint8_t format,
+                                      uint32_t time, uint16_t millis,
+                                      const int32_t *sample)
 {
-	int i, len;
+	int i;
+	int64_t prev = 0;
+	uint64_t zz;
+
+	*p++ = format;
+	p = decode_put_le(p, time, 4);
+	p = decode_put_le(p, millis, 2);
+	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+		if (format == CONFIG_WAVE_RAW) {
+			p = decode_put_le(p, (uint32_t)sample[i], 4);
+			continue;
+		}
+		zz = (uint64_t)(sample[i] - prev) << 1 ^ -(uint64_t)(sample[i] < prev);
+		prev = sample[i];
+		for (; zz >= 0x80; zz >>= 7) {
+			*p++ = (unsigned char)(zz | 0x80);
+		}
+		*p++ = (unsigned char)zz;
+	}
+	return p;
+}
 
-	len = b->data[(b->tail + 1) % FLX_BUFFER_SIZE];
-	for (i = 0; i < len; i++) {
-		*((unsigned char *)sink + i) = b->data[(b->tail + 2 + i) %
-		                               FLX_BUFFER_SIZE];
+/* a waveform telegram in the configured payload format, into d->data */
+static void decode_wave(struct decode_s *d, uint32_t time, uint16_t millis,
+                        const int32_t *sample, const char *unit)
+{
+	if (conf.wave == CONFIG_WAVE_JSON) {
+		d->len = decode_fmt_wave((char *)d->data, time, millis, sample,
+		                         unit) - (char *)d->data;
+	} else {
+		d->len = decode_bin_wave(d->data, conf.wave, time, millis, sample) -
+		         d->data;
 	}
-	return len;
+}
+
+/* [time, value, "unit"] or [time, value.frac, "unit"] with frac in 1/1000 */
+static int decode_fmt_reading(char *p, uint32_t time, int32_t value,
+                              bool sign, uint16_t frac, const char *unit)
+{
+	char *start = p;
+
+	p = fmt_chr(p, '[');
+	p = fmt_i32(p, (int32_t)time);
+	p = fmt_str(p, ", ");
+	p = sign ? fmt_i32(p, value) : fmt_u32(p, (uint32_t)value);
+	if (frac != 0) {
+		p = fmt_chr(p, '.');
+		p = fmt_u32_pad(p, frac, DECODE_FRAC_DIGITS);
+	}
+	p = fmt_str(p, ", \"");
+	p = fmt_str(p, unit);
+	p = fmt_str(p, "\"]");
+	return p - start;
+}
+
+/* value in 1/1000, formatted like a reading: no fraction when it is zero */
+static char *decode_fmt_milli(char *p, int64_t milli)
+{
+	uint64_t abs = milli < 0 ? -(uint64_t)milli : (uint64_t)milli;
+
+	if (milli < 0) {
+		p = fmt_chr(p, '-');
+	}
+	p = fmt_u32(p, (uint32_t)(abs / 1000));
+	if (abs % 1000 != 0) {
+		p = fmt_chr(p, '.');
+		p = fmt_u32_pad(p, (uint32_t)(abs % 1000), DECODE_FRAC_DIGITS);
+	}
+	return p;
+}
+
+/* [[start,window],[min,mean,max,last],"unit"] */
+static int decode_fmt_stats(char *p, uint32_t start, uint32_t window,
+                            int64_t min, int64_t mean, int64_t max,
+                            int64_t last, const char *unit)
+{
+	char *begin = p;
+
+	p = fmt_str(p, "[[");
+	p = fmt_i32(p, (int32_t)start);
+	p = fmt_chr(p, ',');
+	p = fmt_u32(p, window);
+	p = fmt_str(p, "],[");
+	p = decode_fmt_milli(p, min);
+	p = fmt_chr(p, ',');
+	p = decode_fmt_milli(p, mean);
+	p = fmt_chr(p, ',');
+	p = decode_fmt_milli(p, max);
+	p = fmt_chr(p, ',');
+	p = decode_fmt_milli(p, last);
+	p = fmt_str(p, "],\"");
+	p = fmt_str(p, unit);
+	p = fmt_str(p, "\"]");
+	return p - begin;
+}
+
+/* [[start,duration],delta,"unit"] */
+static int decode_fmt_interval(char *p, uint32_t start, uint32_t duration,
+                               int64_t delta, const char *unit)
+{
+	char *begin = p;
+
+	p = fmt_str(p, "[[");
+	p = fmt_i32(p, (int32_t)start);
+	p = fmt_chr(p, ',');
+	p = fmt_u32(p, duration);
+	p = fmt_str(p, "],");
+	p = decode_fmt_milli(p, delta);
+	p = fmt_str(p, ",\"");
+	p = fmt_str(p, unit);
+	p = fmt_str(p, "\"]");
+	return p - begin;
 }
 
 static bool decode_ping(struct buffer_s *b, struct decode_s *d)
@@ -240,7 +381,8 @@ static bool decode_pong(struct buffer_s *b, struct decode_s *d)
 {
 	d->dest = DECODE_DEST_DAEMON;
 	d->type = FLX_TYPE_PONG;
-	d->len = decode_memcpy(b, d->data);
+	d->len = decode_payload_len(b);
+	memcpy(d->data, decode_payload(b), d->len);
 	return true;
 }
 
@@ -272,8 +414,7 @@ static bool decode_time_stamp(struct buffer_s *b, struct decode_s *d)
 
 	if (gettimeofday(&t_flm, NULL) != 0)
 		return false;
-	d->len = decode_memcpy(b, (unsigned char *)&t_flx.tv_sec);
-	t_flx.tv_sec = ltobl(t_flx.tv_sec);
+	t_flx.tv_sec = decode_le32(decode_payload(b));
 	if (!time_threshold(&t_flm) && time_threshold(&t_flx)) {
 		settimeofday(&t_flx, NULL);
 		flm_update = "true";
@@ -294,8 +435,7 @@ static bool decode_time_stamp(struct buffer_s *b, struct decode_s *d)
 	    (int)t_flx.tv_usec,
 	    flx_update);
 	snprintf(topic, CONFIG_STR_MAX, DECODE_TOPIC_TIME, conf.device);
-	mosquitto_publish(conf.mosq, NULL, topic, d->len, d->data, conf.mqtt.qos,
-	                  conf.mqtt.retain);
+	pub_publish(topic, d->len, d->data, conf.mqtt.qos, conf.mqtt.retain);
 	return true;
 }
 
@@ -304,63 +444,27 @@ static bool decode_voltage(struct buffer_s *b, struct decode_s *d)
 	int i;
 	char topic[CONFIG_STR_MAX];
 	struct voltage_s v;
+	const unsigned char *p = decode_payload(b);
 
 	d->dest = DECODE_DEST_MQTT;
 	d->type = FLX_TYPE_VOLTAGE;
-	decode_memcpy(b, (unsigned char *)&v);
-	v.time = ltobl(v.time);
-	v.millis = ltobs(v.millis);
-	v.rms = ltobl(v.rms);
+	v.time = DECODE_LE32(p, voltage_s, time);
+	v.millis = DECODE_LE16(p, voltage_s, millis);
+	v.rms = DECODE_LE32(p, voltage_s, rms);
 	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
-		v.sample[i] = ltobl(v.sample[i]);
+		v.sample[i] = decode_le32(p + offsetof(struct voltage_s, sample) + 4 * i);
 	}
-	d->len = snprintf((char *)d->data,
-	    DECODE_BUFFER_SIZE,
-	    DECODE_VOLTAGE,
-	    v.time,
-	    v.millis,
-	    (long)v.sample[0],
-	    (long)v.sample[1],
-	    (long)v.sample[2],
-	    (long)v.sample[3],
-	    (long)v.sample[4],
-	    (long)v.sample[5],
-	    (long)v.sample[6],
-	    (long)v.sample[7],
-	    (long)v.sample[8],
-	    (long)v.sample[9],
-	    (long)v.sample[10],
-	    (long)v.sample[11],
-	    (long)v.sample[12],
-	    (long)v.sample[13],
-	    (long)v.sample[14],
-	    (long)v.sample[15],
-	    (long)v.sample[16],
-	    (long)v.sample[17],
-	    (long)v.sample[18],
-	    (long)v.sample[19],
-	    (long)v.sample[20],
-	    (long)v.sample[21],
-	    (long)v.sample[22],
-	    (long)v.sample[23],
-	    (long)v.sample[24],
-	    (long)v.sample[25],
-	    (long)v.sample[26],
-	    (long)v.sample[27],
-	    (long)v.sample[28],
-	    (long)v.sample[29],
-	    (long)v.sample[30],
-	    (long)v.sample[31]);
+	decode_wave(d, v.time, v.millis, v.sample, DECODE_UNIT_VOLTAGE);
 	snprintf(topic, CONFIG_STR_MAX, DECODE_TOPIC_VOLTAGE, conf.device, 1);
-	mosquitto_publish(conf.mosq, NULL, topic, d->len, d->data, conf.mqtt.qos,
-	                  conf.mqtt.retain);
+	pub_publish_bulk(topic, d->len, d->data, conf.mqtt.qos,
+	                 conf.mqtt.retain);
 #ifdef WITH_YKW
 	if (ykw_process_voltage(conf.ykw, v.time, v.millis, v.rms, (long *)v.sample,
 	                       DECODE_NUM_SAMPLES)) {
 		snprintf(topic, CONFIG_STR_MAX, YKW_TOPIC_EVENT, conf.device);
-		mosquitto_publish(conf.mosq, NULL, topic, conf.ykw->db.fill,
-		                  conf.ykw->db.buffer, conf.mqtt.qos + 1,
-		                  conf.mqtt.retain);
+		pub_publish(topic, conf.ykw->db.fill,
+		            conf.ykw->db.buffer, conf.mqtt.qos + 1,
+		            conf.mqtt.retain);
 	}
 #endif
 	return true;
@@ -371,57 +475,22 @@ static bool decode_current(struct buffer_s *b, struct decode_s *d)
 	int i;
 	char topic[CONFIG_STR_MAX];
 	struct current_s c;
+	const unsigned char *p = decode_payload(b);
 
 	d->dest = DECODE_DEST_MQTT;
 	d->type = FLX_TYPE_CURRENT;
-	decode_memcpy(b, (unsigned char *)&c);
-	c.time = ltobl(c.time);
-	c.millis = ltobs(c.millis);
-	c.rms = ltobl(c.rms);
+	c.time = DECODE_LE32(p, current_s, time);
+	c.millis = DECODE_LE16(p, current_s, millis);
+	c.index = DECODE_U8(p, current_s, index);
+	c.rms = DECODE_LE32(p, current_s, rms);
 	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
-		c.sample[i] = ltobl(c.sample[i]);
+		c.sample[i] = decode_le32(p + offsetof(struct current_s, sample) + 4 * i);
 	}
-	d->len = snprintf((char *)d->data,
-	    DECODE_BUFFER_SIZE,
-	    DECODE_CURRENT,
-	    c.time,
-	    c.millis,
-	    (long)c.sample[0],
-	    (long)c.sample[1],
-	    (long)c.sample[2],
-	    (long)c.sample[3],
-	    (long)c.sample[4],
-	    (long)c.sample[5],
-	    (long)c.sample[6],
-	    (long)c.sample[7],
-	    (long)c.sample[8],
-	    (long)c.sample[9],
-	    (long)c.sample[10],
-	    (long)c.sample[11],
-	    (long)c.sample[12],
-	    (long)c.sample[13],
-	    (long)c.sample[14],
-	    (long)c.sample[15],
-	    (long)c.sample[16],
-	    (long)c.sample[17],
-	    (long)c.sample[18],
-	    (long)c.sample[19],
-	    (long)c.sample[20],
-	    (long)c.sample[21],
-	    (long)c.sample[22],
-	    (long)c.sample[23],
-	    (long)c.sample[24],
-	    (long)c.sample[25],
-	    (long)c.sample[26],
-	    (long)c.sample[27],
-	    (long)c.sample[28],
-	    (long)c.sample[29],
-	    (long)c.sample[30],
-	    (long)c.sample[31]);
+	decode_wave(d, c.time, c.millis, c.sample, DECODE_UNIT_CURRENT);
 	snprintf(topic, CONFIG_STR_MAX, DECODE_TOPIC_CURRENT, conf.device,
 	         c.index + 1);
-	mosquitto_publish(conf.mosq, NULL, topic, d->len, d->data, conf.mqtt.qos,
-	                  conf.mqtt.retain);
+	pub_publish_bulk(topic, d->len, d->data, conf.mqtt.qos,
+	                 conf.mqtt.retain);
 #ifdef WITH_YKW
 	ykw_process_current(conf.ykw, c.time, c.millis, c.index, c.rms,
 	                    (long *)c.sample, DECODE_NUM_SAMPLES);
@@ -429,40 +498,167 @@ static bool decode_current(struct buffer_s *b, struct decode_s *d)
 	return true;
 }
 
-static void decode_pub_counter(char *sid, uint32_t time, uint32_t counter,
-                               uint16_t frac, const char *unit)
+/*
+ * Deadband: a reading within its band of the last published one is held
+ * back, until the heartbeat runs out if the sensor has one. Counters only
+ * use the absolute band, they are cumulative so nothing is lost.
+ */
+static bool decode_deadband_pass(struct decode_plan_entry *e, uint32_t time,
+                                 int64_t value)
+{
+	const struct sensor *s = &conf.sensor[e->sensor];
+	int64_t delta, band;
+
+	if (s->heartbeat == 0 && s->deadband == 0 &&
+	    (e->kind != DECODE_KIND_GAUGE || s->deadband_rel == 0)) {
+		return true;
+	}
+	if (e->published &&
+	    (s->heartbeat == 0 || time - e->last_time < s->heartbeat)) {
+		delta = value > e->last ? value - e->last : e->last - value;
+		band = s->deadband;
+		if (e->kind == DECODE_KIND_GAUGE && s->deadband_rel > 0) {
+			int64_t rel = (e->last < 0 ? -e->last : e->last) *
+			              s->deadband_rel / 1000000;
+			band = rel > band ? rel : band;
+		}
+		if (delta <= band) {
+			decode_held++;
+			return false;
+		}
+	}
+	e->published = true;
+	e->last = value;
+	e->last_time = time;
+	return true;
+}
+
+/*
+ * Counters must get through: they are spooled while the broker is out of
+ * reach. Gauges can be shed under backpressure.
+ */
+static void decode_publish(const struct decode_plan_entry *e, uint32_t time,
+                           const char *data, int len)
+{
+	if (conf.bundle) {
+		bundle_add(e->kind == DECODE_KIND_COUNTER ? BUNDLE_COUNTERS :
+		           BUNDLE_GAUGES, e->topic, time, data, len);
+		return;
+	}
+	if (e->kind == DECODE_KIND_COUNTER && spool_take(e->topic, data, len)) {
+		return;
+	}
+	pub_publish_alias(e->kind == DECODE_KIND_COUNTER ? PUB_CLASS_DATA :
+	                  PUB_CLASS_GAUGE, e->alias, e->topic, len, data,
+	                  conf.mqtt.qos, conf.mqtt.retain);
+}
+
+/*
+ * Gauge window: fold each reading into min/max/sum/last and publish one
+ * summary per wall-clock aligned window. A window is closed by the first
+ * reading that falls in a later one, so a sensor that stops reporting
+ * leaves its last window unpublished.
+ */
+static void decode_window_add(struct decode_plan_entry *e, uint32_t time,
+                              int64_t milli)
+{
+	int len;
+	char data[DECODE_STATS_MAX];
+	uint32_t window = conf.sensor[e->sensor].window;
+	uint32_t start = time - time % window;
+
+	if (e->win_count > 0 && start != e->win_start) {
+		len = decode_fmt_stats(data, e->win_start, window, e->win_min,
+		                       e->win_sum / e->win_count, e->win_max,
+		                       e->win_last, e->unit);
+		decode_publish(e, e->win_start + window, data, len);
+		e->win_count = 0;
+	}
+	if (e->win_count == 0) {
+		e->win_start = start;
+		e->win_min = milli;
+		e->win_max = milli;
+		e->win_sum = 0;
+	}
+	e->win_min = milli < e->win_min ? milli : e->win_min;
+	e->win_max = milli > e->win_max ? milli : e->win_max;
+	e->win_sum += milli;
+	e->win_last = milli;
+	e->win_count++;
+}
+
+/*
+ * Counter interval: snapshot the counter on the first reading of every
+ * wall-clock aligned interval and publish the difference with the previous
+ * snapshot, so consecutive records add up without gaps. The interval the
+ * daemon started in is incomplete and is not published. After missed
+ * readings a record spans several intervals and says so in its duration.
+ * A counter that went backwards (board reset) restarts the snapshots.
+ */
+static void decode_interval_add(struct decode_plan_entry *e, uint32_t time,
+                                uint64_t fixed)
+{
+	int len;
+	char data[DECODE_STATS_MAX];
+	uint32_t interval = conf.sensor[e->sensor].interval;
+	uint32_t start = time - time % interval;
+
+	if (e->iv_open && start == e->iv_start) {
+		return;
+	}
+	if (e->iv_open && !e->iv_partial && fixed >= e->iv_snap) {
+		/* 1/65536 to 1/1000, rounded */
+		len = decode_fmt_interval(data, e->iv_start, start - e->iv_start,
+		          (int64_t)(((fixed - e->iv_snap) * 1000 + 0x8000) >> 16),
+		          e->unit);
+		decode_publish(e, start, data, len);
+	}
+	e->iv_partial = !e->iv_open || fixed < e->iv_snap;
+	e->iv_open = true;
+	e->iv_start = start;
+	e->iv_snap = fixed;
+}
+
+/* fixed is the counter in 1/65536 of the unit, for the interval rollup */
+static void decode_pub_counter(struct decode_plan_entry *e, uint32_t time,
+                               uint32_t counter, uint16_t frac, uint64_t fixed)
 {
 	int len;
-	char topic[CONFIG_STR_MAX];
 	char data[CONFIG_STR_MAX];
+	int64_t milli = (int64_t)counter * 1000 + frac;
 
-	snprintf(topic, CONFIG_STR_MAX, DECODE_TOPIC_COUNTER, sid);
-	if (frac == 0) {
-		len = snprintf(data, CONFIG_STR_MAX, DECODE_COUNTER, time, counter, unit);
-	} else {
-		len = snprintf(data, CONFIG_STR_MAX, DECODE_COUNTER_FRAC, time,
-		               counter, frac, unit);
+	history_add(e->sensor, HISTORY_COUNTER, e->unit, time, milli);
+	latest_counter(e->sensor, e->unit, time, milli);
+	if (conf.sensor[e->sensor].interval > 0) {
+		decode_interval_add(e, time, fixed);
+		return;
+	}
+	if (!decode_deadband_pass(e, time, milli)) {
+		return;
 	}
-	mosquitto_publish(conf.mosq, NULL, topic, len, data, conf.mqtt.qos,
-	                  conf.mqtt.retain);
+	len = decode_fmt_reading(data, time, (int32_t)counter, false, frac,
+	                         e->unit);
+	decode_publish(e, time, data, len);
 }
 
-static void decode_pub_gauge(char *sid, uint32_t time, int32_t gauge,
-                             uint16_t frac, const char *unit)
+/* milli is the reading in 1/1000 of its unit, for the deadband */
+static void decode_pub_gauge(struct decode_plan_entry *e, uint32_t time,
+                             int32_t gauge, uint16_t frac, int64_t milli)
 {
 	int len;
-	char topic[CONFIG_STR_MAX];
 	char data[CONFIG_STR_MAX];
 
-	snprintf(topic, CONFIG_STR_MAX, DECODE_TOPIC_GAUGE, sid);
-	if (frac == 0) {
-		len = snprintf(data, CONFIG_STR_MAX, DECODE_GAUGE, time, gauge, unit);
-	} else {
-		len = snprintf(data, CONFIG_STR_MAX, DECODE_GAUGE_FRAC, time,
-		               gauge, frac, unit);
+	history_add(e->sensor, HISTORY_GAUGE, e->unit, time, milli);
+	latest_gauge(e->sensor, e->unit, time, milli);
+	if (conf.sensor[e->sensor].window > 0) {
+		decode_window_add(e, time, milli);
+		return;
 	}
-	mosquitto_publish(conf.mosq, NULL, topic, len, data, conf.mqtt.qos,
-	                  conf.mqtt.retain);
+	if (!decode_deadband_pass(e, time, milli)) {
+		return;
+	}
+	len = decode_fmt_reading(data, time, gauge, true, frac, e->unit);
+	decode_publish(e, time, data, len);
 }
 
 /* fractional to decimal conversion */
@@ -471,75 +667,176 @@ static uint16_t ftod(uint16_t frac, uint8_t width)
 	return (uint16_t)((frac * 125) >> (width - 3));
 }
 
-static bool decode_ct_data(struct buffer_s *b, struct decode_s *d)
+static struct decode_plan_entry *decode_plan_add(int port, uint8_t kind,
+                                                 uint8_t param, int sensor,
+                                                 const char *unit)
 {
-	int i, offset;
-	int32_t integer;
-	uint16_t decimal;
-	struct ct_data_s ct;
-
-	decode_memcpy(b, (unsigned char *)&ct);
-	offset = ct.port * DECODE_MAX_CT_PARAMS;
-	ct.time = ltobl(ct.time) - 1;
-	ct.millis = ltobs(ct.millis);
-	for (i = 0; i <= DECODE_CT_PARAM_Q4; i++) {
-		if (!conf.sensor[offset + i].enable) {
-			continue;
+	struct decode_plan *plan = &decode_plan[port];
+	struct decode_plan_entry *e = &plan->entry[plan->len];
+	char *topic = decode_plan_topic[port][plan->len];
+	const char *format;
+
+	if (kind == DECODE_KIND_COUNTER) {
+		format = conf.sensor[sensor].interval > 0 ? DECODE_TOPIC_INTERVAL :
+		         DECODE_TOPIC_COUNTER;
+	} else {
+		format = conf.sensor[sensor].window > 0 ? DECODE_TOPIC_STATS :
+		         DECODE_TOPIC_GAUGE;
+	}
+	snprintf(topic, DECODE_PLAN_TOPIC_MAX, format, conf.sensor[sensor].id);
+	e->kind = kind;
+	e->param = param;
+	e->sensor = sensor;
+	e->factor = 1;
+	e->unit = unit;
+	e->topic = topic;
+	plan->len++;
+	history_plan_add(sensor, kind == DECODE_KIND_COUNTER ? HISTORY_COUNTER :
+	                 HISTORY_GAUGE);
+	return e;
+}
+
+/*
+ * Number the topic aliases 1, 2, .. over the published entries, gauges
+ * first. A broker only grants topic_alias_maximum of them, 10 by default
+ * for mosquitto, and the gauges are the topics sent every second.
+ */
+static void decode_plan_alias(void)
+{
+	static const uint8_t kind[] = { DECODE_KIND_GAUGE, DECODE_KIND_COUNTER };
+	int k, port, i;
+	uint16_t alias = 0;
+	struct decode_plan_entry *e;
+
+	for (k = 0; k < sizeof(kind); k++) {
+		for (port = 0; port < DECODE_PLAN_PORTS; port++) {
+			for (i = 0; i < decode_plan[port].len; i++) {
+				e = &decode_plan[port].entry[i];
+				if (e->kind == kind[k]) {
+					e->alias = ++alias;
+				}
+			}
 		}
-		decode_pub_counter(conf.sensor[offset + i].id,
-		                   ct.time,
-		                   ltobl(ct.counter_integ[i]),
-		                   ftod(ltobs(ct.counter_frac[i]), 16),
-		                   decode_ct_counter_unit[i]);
-	}
-	for (i = 0; i < DECODE_MAX_CT_PARAMS; i++) {
-		ct.gauge[i] = ltobl(ct.gauge[i]);
-		if (!conf.sensor[offset + i].enable) {
+	}
+}
+
+/*
+ * Walk the sensor config once and keep, per port, only the readings that
+ * get published, in publish order: all counters, then all gauges.
+ */
+static void decode_plan_build(void)
+{
+	int port, i, sensor;
+	uint8_t type;
+	struct decode_plan_entry *e;
+
+	memset(decode_plan, 0, sizeof(decode_plan));
+	history_plan_clear();
+	for (port = 0; port < CONFIG_MAX_ANALOG_PORTS; port++) {
+		sensor = port * DECODE_MAX_CT_PARAMS;
+		for (i = 0; i <= DECODE_CT_PARAM_Q4; i++) {
+			if (conf.sensor[sensor + i].enable) {
+				decode_plan_add(port, DECODE_KIND_COUNTER, i, sensor + i,
+				                decode_ct_counter_unit[i]);
+			}
+		}
+		for (i = 0; i < DECODE_MAX_CT_PARAMS; i++) {
+			if (conf.sensor[sensor + i].enable) {
+				decode_plan_add(port, DECODE_KIND_GAUGE, i, sensor + i,
+				                decode_ct_gauge_unit[i]);
+			}
+		}
+	}
+	for (; port < DECODE_PLAN_PORTS; port++) {
+		sensor = DECODE_PULSE_SENSOR(port);
+		if (!conf.sensor[sensor].enable) {
 			continue;
 		}
-		integer = ct.gauge[i] >> 11; /* ASR */
-		decimal = ftod(ct.gauge[i] & DECODE_11BIT_FRAC_MASK, 11);
-		decode_pub_gauge(conf.sensor[offset + i].id,
-		                 ct.time,
-		                 integer,
-		                 decimal,
-		                 decode_ct_gauge_unit[i]);
-	}
-	shift_push_params(ct.port, ct.gauge[DECODE_CT_PARAM_ALPHA],
-	                  ct.gauge[DECODE_CT_PARAM_IRMS]);
+		type = conf.sensor[sensor].type;
+		decode_plan_add(port, DECODE_KIND_COUNTER, 0, sensor,
+		                decode_pulse_counter_unit[type]);
+		e = decode_plan_add(port, DECODE_KIND_GAUGE, 0, sensor,
+		                    decode_pulse_gauge_unit[type]);
+		e->factor = decode_pulse_gauge_factor[type];
+	}
+	decode_plan_alias();
+}
+
+static bool decode_ct_data(struct buffer_s *b, struct decode_s *d)
+{
+	uint8_t port;
+	uint32_t time, integ;
+	uint16_t frac;
+	int32_t gauge;
+	struct decode_plan_entry *e, *end;
+	const unsigned char *p = decode_payload(b);
+
+	port = DECODE_U8(p, ct_data_s, port);
+	if (port >= CONFIG_MAX_ANALOG_PORTS) {
+		return false;
+	}
+	time = DECODE_LE32(p, ct_data_s, time) - 1;
+	end = decode_plan[port].entry + decode_plan[port].len;
+	for (e = decode_plan[port].entry; e < end; e++) {
+		if (e->kind == DECODE_KIND_COUNTER) {
+			integ = decode_le32(p + offsetof(struct ct_data_s, counter_integ) +
+			                    4 * e->param);
+			frac = decode_le16(p + offsetof(struct ct_data_s, counter_frac) +
+			                   2 * e->param);
+			decode_pub_counter(e, time, integ, ftod(frac, 16),
+			                   DECODE_COUNTER_FIXED(integ, frac));
+		} else {
+			gauge = (int32_t)decode_le32(p + offsetof(struct ct_data_s, gauge) +
+			                             4 * e->param);
+			decode_pub_gauge(e,
+			                 time,
+			                 gauge >> 11, /* ASR */
+			                 ftod(gauge & DECODE_11BIT_FRAC_MASK, 11),
+			                 ((int64_t)gauge * 1000) >> 11);
+		}
+	}
+	shift_push_params(port,
+	    (int32_t)decode_le32(p + offsetof(struct ct_data_s, gauge) +
+	                         4 * DECODE_CT_PARAM_ALPHA),
+	    (int32_t)decode_le32(p + offsetof(struct ct_data_s, gauge) +
+	                         4 * DECODE_CT_PARAM_IRMS));
 	return false;
 }
 
 static bool decode_pulse_data(struct buffer_s *b, struct decode_s *d)
 {
-	int offset, sensor;
-	struct pulse_data_s pulse;
-	float gauge_integ, gauge_frac;
-
-	decode_memcpy(b, (unsigned char*)&pulse);
-	offset = CONFIG_MAX_ANALOG_PORTS * DECODE_MAX_CT_PARAMS;
-	sensor = offset + pulse.port - CONFIG_MAX_ANALOG_PORTS;
-	if (!conf.sensor[sensor].enable) {
+	uint8_t port;
+	uint32_t time, integ;
+	uint16_t millis;
+	int32_t gauge;
+	int64_t scaled, frac;
+	struct decode_plan_entry *e;
+	const unsigned char *p = decode_payload(b);
+
+	port = DECODE_U8(p, pulse_data_s, port);
+	if (port < CONFIG_MAX_ANALOG_PORTS || port >= DECODE_PLAN_PORTS ||
+	    decode_plan[port].len == 0) {
 		return false;
 	}
-	pulse.time = ltobl(pulse.time);
-	pulse.millis = ltobs(pulse.millis);
-	decode_pub_counter(conf.sensor[sensor].id,
-	                   pulse.time,
-	                   ltobl(pulse.counter_integ),
-	                   ltobs(pulse.counter_millis),
-	                   decode_pulse_counter_unit[conf.sensor[sensor].type]);
-	pulse.gauge = ltobl(pulse.gauge);
-	if (pulse.gauge == 0) {
+	e = decode_plan[port].entry;
+	time = DECODE_LE32(p, pulse_data_s, time);
+	integ = DECODE_LE32(p, pulse_data_s, counter_integ);
+	millis = DECODE_LE16(p, pulse_data_s, counter_millis);
+	decode_pub_counter(&e[0], time, integ, millis,
+	                   DECODE_COUNTER_FIXED(integ, ((uint32_t)millis << 16) / 1000));
+	gauge = (int32_t)DECODE_LE32(p, pulse_data_s, gauge);
+	/* idle pulse inputs only count towards a window */
+	if (gauge == 0 && conf.sensor[e[1].sensor].window == 0) {
 		return false;
 	}
-	gauge_frac = modff((float)pulse.gauge / 2048.0f *
-	             decode_pulse_gauge_factor[conf.sensor[sensor].type], &gauge_integ);
-	decode_pub_gauge(conf.sensor[sensor].id,
-	                 pulse.time,
-	                 (int32_t)gauge_integ,
-	                 (uint16_t)fabsf(gauge_frac * 1000.0f),
-	                 decode_pulse_gauge_unit[conf.sensor[sensor].type]);
+	/* q20.11 times the unit factor, integer part truncated towards zero */
+	scaled = (int64_t)gauge * e[1].factor;
+	frac = scaled % 2048;
+	decode_pub_gauge(&e[1],
+	                 time,
+	                 (int32_t)(scaled / 2048),
+	                 (uint16_t)(((frac < 0 ? -frac : frac) * 1000) >> 11),
+	                 scaled * 1000 / 2048);
 	return false;
 }
 
@@ -547,19 +844,23 @@ static bool decode_kube_packet(struct buffer_s *b, struct decode_s *d)
 {
 	uint64_t timestamp;
 	size_t packet_len;
-	struct kube_packet_s kube;
-	struct blob_buf ubuf = { 0 }; /* ubus data structure */
+	static struct blob_buf ubuf; /* ubus data structure, reused */
 	uint8_t hex[DECODE_KUBE_MAX_PACKET_SIZE * 2 + 1] = { 0 }; /* null termination */
+	const unsigned char *p = decode_payload(b);
 
-	decode_memcpy(b, (unsigned char *)&kube);
-	kube.time = ltobl(kube.time);
-	kube.millis = ltobs(kube.millis);
-	timestamp = (uint64_t)kube.time * 1000 + kube.millis;
-	packet_len = b->data[(b->tail + 1) % FLX_BUFFER_SIZE] - 7; /* timestamp + rssi */
-	hexlify(kube.packet, hex, packet_len);
+	timestamp = (uint64_t)DECODE_LE32(p, kube_packet_s, time) * 1000 +
+	            DECODE_LE16(p, kube_packet_s, millis);
+	if (decode_payload_len(b) < 7 ||
+	    decode_payload_len(b) - 7 > DECODE_KUBE_MAX_PACKET_SIZE) {
+		return false;
+	}
+	packet_len = decode_payload_len(b) - 7; /* timestamp + rssi */
+	hexlify((unsigned char *)p + offsetof(struct kube_packet_s, packet), hex,
+	        packet_len);
 	blob_buf_init(&ubuf, 0);
 	blobmsg_add_u64(&ubuf, "time", timestamp);
-	blobmsg_add_u16(&ubuf, "rssi", (uint16_t)kube.rssi); /* u8 gives a boolean? */
+	/* u8 gives a boolean? */
+	blobmsg_add_u16(&ubuf, "rssi", (uint16_t)DECODE_U8(p, kube_packet_s, rssi));
 	blobmsg_add_string(&ubuf, "hex", (char *)hex);
 	ubus_send_event(conf.ubus_ctx, DECODE_UBUS_PATH_KUBE_PACKET, ubuf.head);
 	return false;
@@ -570,55 +871,20 @@ static bool decode_debug_sar(struct buffer_s *b, struct decode_s *d)
 	int i;
 	char topic[CONFIG_STR_MAX];
 	struct sar_s sar;
+	int32_t adc[DECODE_NUM_SAMPLES];
+	const unsigned char *p = decode_payload(b);
 
 	d->dest = DECODE_DEST_MQTT;
 	d->type = FLX_TYPE_SAR;
-	decode_memcpy(b, (unsigned char *)&sar);
-	sar.time = ltobl(sar.time);
-	sar.millis = ltobs(sar.millis);
+	sar.time = DECODE_LE32(p, sar_s, time);
+	sar.millis = DECODE_LE16(p, sar_s, millis);
 	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
-		sar.adc[i] = ltobs(sar.adc[i]);
+		adc[i] = decode_le16(p + offsetof(struct sar_s, adc) + 2 * i);
 	}
-	d->len = snprintf((char *)d->data,
-	    DECODE_BUFFER_SIZE,
-	    DECODE_SAR,
-	    sar.time,
-	    sar.millis,
-	    sar.adc[0],
-	    sar.adc[1],
-	    sar.adc[2],
-	    sar.adc[3],
-	    sar.adc[4],
-	    sar.adc[5],
-	    sar.adc[6],
-	    sar.adc[7],
-	    sar.adc[8],
-	    sar.adc[9],
-	    sar.adc[10],
-	    sar.adc[11],
-	    sar.adc[12],
-	    sar.adc[13],
-	    sar.adc[14],
-	    sar.adc[15],
-	    sar.adc[16],
-	    sar.adc[17],
-	    sar.adc[18],
-	    sar.adc[19],
-	    sar.adc[20],
-	    sar.adc[21],
-	    sar.adc[22],
-	    sar.adc[23],
-	    sar.adc[24],
-	    sar.adc[25],
-	    sar.adc[26],
-	    sar.adc[27],
-	    sar.adc[28],
-	    sar.adc[29],
-	    sar.adc[30],
-	    sar.adc[31]);
+	decode_wave(d, sar.time, sar.millis, adc, DECODE_UNIT_SAR);
 	snprintf(topic, CONFIG_STR_MAX, DECODE_TOPIC_SAR, conf.device, 1);
-	mosquitto_publish(conf.mosq, NULL, topic, d->len, d->data, conf.mqtt.qos,
-	                  conf.mqtt.retain);
+	pub_publish_bulk(topic, d->len, d->data, conf.mqtt.qos,
+	                 conf.mqtt.retain);
 	return true;
 }
 
@@ -627,69 +893,31 @@ static bool decode_debug_sdadc(struct buffer_s *b, struct decode_s *d)
 	int i;
 	char topic[CONFIG_STR_MAX];
 	struct sdadc_s sdadc;
+	int32_t adc[DECODE_NUM_SAMPLES];
+	const unsigned char *p = decode_payload(b);
 
 	d->dest = DECODE_DEST_MQTT;
 	d->type = FLX_TYPE_SDADC;
-	decode_memcpy(b, (unsigned char *)&sdadc);
-	sdadc.time = ltobl(sdadc.time);
-	sdadc.millis = ltobs(sdadc.millis);
+	sdadc.time = DECODE_LE32(p, sdadc_s, time);
+	sdadc.millis = DECODE_LE16(p, sdadc_s, millis);
+	sdadc.index = DECODE_U8(p, sdadc_s, index);
 	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
-		sdadc.adc[i] = ltobs(sdadc.adc[i]);
+		adc[i] = (int16_t)decode_le16(p + offsetof(struct sdadc_s, adc) + 2 * i);
 	}
-	d->len = snprintf((char *)d->data,
-	    DECODE_BUFFER_SIZE,
-	    DECODE_SDADC,
-	    sdadc.time,
-	    sdadc.millis,
-	    sdadc.adc[0],
-	    sdadc.adc[1],
-	    sdadc.adc[2],
-	    sdadc.adc[3],
-	    sdadc.adc[4],
-	    sdadc.adc[5],
-	    sdadc.adc[6],
-	    sdadc.adc[7],
-	    sdadc.adc[8],
-	    sdadc.adc[9],
-	    sdadc.adc[10],
-	    sdadc.adc[11],
-	    sdadc.adc[12],
-	    sdadc.adc[13],
-	    sdadc.adc[14],
-	    sdadc.adc[15],
-	    sdadc.adc[16],
-	    sdadc.adc[17],
-	    sdadc.adc[18],
-	    sdadc.adc[19],
-	    sdadc.adc[20],
-	    sdadc.adc[21],
-	    sdadc.adc[22],
-	    sdadc.adc[23],
-	    sdadc.adc[24],
-	    sdadc.adc[25],
-	    sdadc.adc[26],
-	    sdadc.adc[27],
-	    sdadc.adc[28],
-	    sdadc.adc[29],
-	    sdadc.adc[30],
-	    sdadc.adc[31]);
+	decode_wave(d, sdadc.time, sdadc.millis, adc, DECODE_UNIT_SDADC);
 	snprintf(topic, CONFIG_STR_MAX, DECODE_TOPIC_SDADC, conf.device,
 	         sdadc.index + 1);
-	mosquitto_publish(conf.mosq, NULL, topic, d->len, d->data, conf.mqtt.qos,
-	                  conf.mqtt.retain);
+	pub_publish_bulk(topic, d->len, d->data, conf.mqtt.qos,
+	                 conf.mqtt.retain);
 	return true;
 }
 
 static bool decode_debug_rfm(struct buffer_s *b, struct decode_s *d)
 {
-	uint8_t len;
-	uint8_t rfm[DECODE_MAX_TELEGRAM_PAYLOAD_SIZE];
 	uint8_t hex[DECODE_MAX_TELEGRAM_PAYLOAD_SIZE * 2 + 1] = { 0 };
-	struct blob_buf ubuf = { 0 };
+	static struct blob_buf ubuf; /* reused */
 
-	len = b->data[(b->tail + 1) % FLX_BUFFER_SIZE];
-	decode_memcpy(b, rfm);
-	hexlify(rfm, hex, len);
+	hexlify((unsigned char *)decode_payload(b), hex, decode_payload_len(b));
 	blob_buf_init(&ubuf, 0);
 	blobmsg_add_string(&ubuf, "hex", (char *)hex);
 	ubus_send_event(conf.ubus_ctx, DECODE_UBUS_PATH_RFM_DEBUG, ubuf.head);
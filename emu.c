@@ -0,0 +1,677 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * flxemu emulates the sensor board side of the FLX protocol on a pty. It
+ * answers pings, accepts the port configuration and streams telegrams at
+ * configurable rates, throttled to the serial line rate, so that flxd can
+ * be driven to saturation on a build box without a physical board.
+ */
+
+#define _GNU_SOURCE /* ppoll() and posix_openpt() */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <math.h>
+#include <endian.h>
+#include "flx.h"
+#include "payload.h"
+#include "encode.h"
+
+#define EMU_BAUD_DEFAULT		460800
+#define EMU_BITS_PER_BYTE		10 /* 8N1 */
+#define EMU_TELEGRAM_MAX		(255 + ENCODE_SYNC_TL_LEN + ENCODE_FLETCHER16_LEN)
+#define EMU_RX_BUFFER_SIZE		1024
+#define EMU_TX_BUFFER_SIZE		4096
+#define EMU_NSEC				1000000000LL
+#define EMU_PING_INTERVAL		EMU_NSEC
+#define EMU_REPORT_INTERVAL		EMU_NSEC
+#define EMU_PULSE_PORT_FIRST	3
+#define EMU_PULSE_PORTS			3
+#define EMU_PHASES				3
+
+struct emu_stream {
+	const char *name;
+	unsigned char type;
+	size_t (*fill)(unsigned char *payload, unsigned int seq);
+	double rate; /* telegrams per second, 0 when disabled */
+	long long period;
+	long long due;
+	unsigned int seq;
+	unsigned long long sent;
+	unsigned long long overrun;
+};
+
+static struct {
+	int verbosity;
+	int fd;
+	int fd_hold;
+	char *link;
+	unsigned int baud;
+	long long byte_time;
+	long long line_free;
+	bool saturate;
+	bool configured;
+	unsigned int next; /* round robin start */
+	unsigned char rx[EMU_RX_BUFFER_SIZE];
+	size_t rx_len;
+	unsigned char tx[EMU_TX_BUFFER_SIZE];
+	size_t tx_len;
+	unsigned long long bytes;
+	unsigned long long dropped;
+	unsigned long long pings;
+	unsigned long long configs;
+	unsigned long long errors;
+} emu = {
+	.fd = -1,
+	.fd_hold = -1,
+	.baud = EMU_BAUD_DEFAULT
+};
+
+static volatile sig_atomic_t stop;
+
+static void sighandler(int sig)
+{
+	stop = 1;
+}
+
+static long long emu_now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * EMU_NSEC + t.tv_nsec;
+}
+
+static void emu_time(uint32_t *time, uint16_t *millis)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_REALTIME, &t);
+	*time = htole32((uint32_t)t.tv_sec);
+	*millis = htole16((uint16_t)(t.tv_nsec / 1000000));
+}
+
+static int32_t emu_q20dot11(double x)
+{
+	return (int32_t)htole32((uint32_t)(int32_t)lrint(x * 2048));
+}
+
+static double emu_wave(double amplitude, unsigned int i, unsigned int seq)
+{
+	return amplitude * sin(2 * M_PI * (i + seq) / DECODE_NUM_SAMPLES);
+}
+
+static size_t emu_time_stamp(unsigned char *payload, unsigned int seq)
+{
+	uint32_t t = htole32((uint32_t)time(NULL));
+
+	memcpy(payload, &t, sizeof(t));
+	return sizeof(t);
+}
+
+static size_t emu_voltage(unsigned char *payload, unsigned int seq)
+{
+	int i;
+	struct voltage_s *v = (struct voltage_s *)payload;
+
+	memset(v, 0, sizeof(*v));
+	emu_time(&v->time, &v->millis);
+	v->rms = htole32(230000);
+	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+		v->sample[i] = htole32((int32_t)emu_wave(325269, i, seq));
+	}
+	return sizeof(*v);
+}
+
+static size_t emu_current(unsigned char *payload, unsigned int seq)
+{
+	int i;
+	struct current_s *c = (struct current_s *)payload;
+
+	memset(c, 0, sizeof(*c));
+	emu_time(&c->time, &c->millis);
+	c->index = seq % EMU_PHASES;
+	c->rms = htole32(5000);
+	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+		c->sample[i] = htole32((int32_t)emu_wave(7071, i, seq));
+	}
+	return sizeof(*c);
+}
+
+static size_t emu_ct_data(unsigned char *payload, unsigned int seq)
+{
+	int i;
+	uint32_t energy = seq / EMU_PHASES;
+	struct ct_data_s *ct = (struct ct_data_s *)payload;
+
+	memset(ct, 0, sizeof(*ct));
+	emu_time(&ct->time, &ct->millis);
+	ct->port = seq % EMU_PHASES;
+	for (i = 0; i <= DECODE_CT_PARAM_Q4; i++) {
+		ct->counter_integ[i] = htole32(energy * (i + 1));
+		ct->counter_frac[i] = htole16((uint16_t)(seq * 4099));
+	}
+	ct->gauge[DECODE_CT_PARAM_PPLUS] = emu_q20dot11(1150.25);
+	ct->gauge[DECODE_CT_PARAM_Q1] = emu_q20dot11(87.5);
+	ct->gauge[DECODE_CT_PARAM_VRMS] = emu_q20dot11(230.125);
+	ct->gauge[DECODE_CT_PARAM_IRMS] = emu_q20dot11(5.0);
+	ct->gauge[DECODE_CT_PARAM_PF] = emu_q20dot11(0.997);
+	ct->gauge[DECODE_CT_PARAM_VTHD] = emu_q20dot11(0.021);
+	ct->gauge[DECODE_CT_PARAM_ITHD] = emu_q20dot11(0.134);
+	ct->gauge[DECODE_CT_PARAM_ALPHA] = emu_q20dot11(120.0 * ct->port + 4.5);
+	return sizeof(*ct);
+}
+
+static size_t emu_pulse_data(unsigned char *payload, unsigned int seq)
+{
+	struct pulse_data_s *pulse = (struct pulse_data_s *)payload;
+
+	memset(pulse, 0, sizeof(*pulse));
+	emu_time(&pulse->time, &pulse->millis);
+	pulse->port = EMU_PULSE_PORT_FIRST + seq % EMU_PULSE_PORTS;
+	pulse->gauge = emu_q20dot11(0.125);
+	pulse->counter_integ = htole32(seq / EMU_PULSE_PORTS);
+	pulse->counter_millis = htole16((uint16_t)(seq * 125 % 1000));
+	return sizeof(*pulse);
+}
+
+static size_t emu_kube_packet(unsigned char *payload, unsigned int seq)
+{
+	size_t i, len = 10 + seq % (DECODE_KUBE_MAX_PACKET_SIZE - 10);
+	struct kube_packet_s *kube = (struct kube_packet_s *)payload;
+
+	emu_time(&kube->time, &kube->millis);
+	kube->rssi = 40 + seq % 60;
+	for (i = 0; i < len; i++) {
+		kube->packet[i] = (uint8_t)(seq + i);
+	}
+	return offsetof(struct kube_packet_s, packet) + len;
+}
+
+static size_t emu_sar(unsigned char *payload, unsigned int seq)
+{
+	int i;
+	struct sar_s *sar = (struct sar_s *)payload;
+
+	emu_time(&sar->time, &sar->millis);
+	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+		sar->adc[i] = htole16((uint16_t)(2048 + emu_wave(1800, i, seq)));
+	}
+	return sizeof(*sar);
+}
+
+static size_t emu_sdadc(unsigned char *payload, unsigned int seq)
+{
+	int i;
+	struct sdadc_s *sdadc = (struct sdadc_s *)payload;
+
+	memset(sdadc, 0, sizeof(*sdadc));
+	emu_time(&sdadc->time, &sdadc->millis);
+	sdadc->index = seq % EMU_PHASES;
+	for (i = 0; i < DECODE_NUM_SAMPLES; i++) {
+		sdadc->adc[i] = htole16((int16_t)emu_wave(30000, i, seq));
+	}
+	return sizeof(*sdadc);
+}
+
+static struct emu_stream streams[] = {
+	{ "ct", FLX_TYPE_CT_DATA, emu_ct_data },
+	{ "pulse", FLX_TYPE_PULSE_DATA, emu_pulse_data },
+	{ "voltage", FLX_TYPE_VOLTAGE, emu_voltage },
+	{ "current", FLX_TYPE_CURRENT, emu_current },
+	{ "sar", FLX_TYPE_SAR, emu_sar },
+	{ "sdadc", FLX_TYPE_SDADC, emu_sdadc },
+	{ "kube", FLX_TYPE_KUBE_PACKET, emu_kube_packet },
+	{ "time", FLX_TYPE_TIME_STAMP, emu_time_stamp }
+};
+
+#define EMU_MAX_STREAMS (sizeof(streams) / sizeof(streams[0]))
+
+static void emu_flush(void)
+{
+	ssize_t n;
+
+	if (emu.tx_len == 0) {
+		return;
+	}
+	n = write(emu.fd, emu.tx, emu.tx_len);
+	if (n <= 0) {
+		return;
+	}
+	memmove(emu.tx, emu.tx + n, emu.tx_len - n);
+	emu.tx_len -= n;
+}
+
+/* returns false when flxd is not draining the pty fast enough */
+static bool emu_send(unsigned char type, const unsigned char *payload,
+                     size_t len)
+{
+	size_t size = len + ENCODE_SYNC_TL_LEN + ENCODE_FLETCHER16_LEN;
+	struct encode_s e = (struct encode_s) {
+		.type = type,
+		.data = payload,
+		.len = len
+	};
+
+	if (emu.tx_len + size > EMU_TX_BUFFER_SIZE) {
+		emu.dropped++;
+		return false;
+	}
+	encode_handler(&e, emu.tx + emu.tx_len);
+	emu.tx_len += size;
+	emu.bytes += size;
+	emu_flush();
+	if (emu.baud > 0) {
+		emu.line_free += size * emu.byte_time;
+	}
+	return true;
+}
+
+static struct emu_stream *emu_next_due(long long now)
+{
+	unsigned int i;
+	struct emu_stream *s;
+
+	for (i = 0; i < EMU_MAX_STREAMS; i++) {
+		s = &streams[(emu.next + i) % EMU_MAX_STREAMS];
+		if (s->rate > 0 && s->due <= now) {
+			emu.next = (emu.next + i + 1) % EMU_MAX_STREAMS;
+			return s;
+		}
+	}
+	return NULL;
+}
+
+static bool emu_tx_full(void)
+{
+	return emu.tx_len + EMU_TELEGRAM_MAX > EMU_TX_BUFFER_SIZE;
+}
+
+static void emu_schedule(long long now)
+{
+	size_t len;
+	struct emu_stream *s;
+	unsigned char payload[EMU_TELEGRAM_MAX];
+
+	/* an idle line does not bank credit beyond one telegram's worth */
+	if (emu.line_free < now - EMU_TELEGRAM_MAX * emu.byte_time) {
+		emu.line_free = now - EMU_TELEGRAM_MAX * emu.byte_time;
+	}
+	/* round robin over the due streams for as long as the line is idle */
+	while (emu.line_free <= now && !(emu.saturate && emu_tx_full()) &&
+	       (s = emu_next_due(now)) != NULL) {
+		if (s->period > 0 && now - s->due >= s->period) {
+			/* the line could not keep up with the requested rate */
+			s->overrun += (now - s->due) / s->period;
+			s->due = now;
+		}
+		s->due += s->period;
+		len = s->fill(payload, s->seq);
+		if (!emu_send(s->type, payload, len)) {
+			break;
+		}
+		s->seq++;
+		s->sent++;
+	}
+}
+
+/* when the main loop has to wake up for the next telegram or report */
+static long long emu_next_event(long long now, long long report,
+                                long long ping)
+{
+	unsigned int i;
+	long long t, wake = report;
+
+	if (!emu.configured && ping < wake) {
+		wake = ping;
+	}
+	if (emu.saturate && emu_tx_full()) {
+		return wake; /* POLLOUT wakes us up */
+	}
+	for (i = 0; i < EMU_MAX_STREAMS; i++) {
+		if (streams[i].rate <= 0) {
+			continue;
+		}
+		t = streams[i].due > emu.line_free ? streams[i].due : emu.line_free;
+		if (t < wake) {
+			wake = t;
+		}
+	}
+	return wake;
+}
+
+static void emu_rx_telegram(unsigned char type, unsigned char *payload,
+                            size_t len)
+{
+	switch (type) {
+	case FLX_TYPE_PING:
+		emu.pings++;
+		emu_send(FLX_TYPE_PONG, payload, len);
+		break;
+	case FLX_TYPE_PORT_CONFIG:
+		emu.configs++;
+		emu.configured = true;
+		if (emu.verbosity > 0) {
+			fprintf(stdout, "[emu] port config, %zu bytes\n", len);
+		}
+		break;
+	case FLX_TYPE_EXIT:
+		if (emu.verbosity > 0) {
+			fprintf(stdout, "[emu] flxd exit\n");
+		}
+		emu.configured = false;
+		break;
+	default:
+		if (emu.verbosity > 1) {
+			fprintf(stdout, "[emu] rx type %d, %zu bytes\n", type, len);
+		}
+		break;
+	}
+}
+
+static void emu_rx(void)
+{
+	ssize_t n;
+	size_t i = 0, size;
+	unsigned short check;
+
+	n = read(emu.fd, emu.rx + emu.rx_len, sizeof(emu.rx) - emu.rx_len);
+	if (n <= 0) {
+		return;
+	}
+	emu.rx_len += n;
+	while (emu.rx_len - i >= ENCODE_SYNC_TL_LEN) {
+		if (emu.rx[i] != FLX_PROTO_SYNC || emu.rx[i + 1] != FLX_PROTO_SYNC) {
+			i++;
+			continue;
+		}
+		size = emu.rx[i + 3] + ENCODE_SYNC_TL_LEN + ENCODE_FLETCHER16_LEN;
+		if (emu.rx_len - i < size) {
+			break;
+		}
+		check = encode_fletcher16(emu.rx + i + 2, emu.rx[i + 3] + 2);
+		if (emu.rx[i + size - 2] == (check >> 8) &&
+		    emu.rx[i + size - 1] == (check & 0xff)) {
+			emu_rx_telegram(emu.rx[i + 2], emu.rx + i + ENCODE_SYNC_TL_LEN,
+			                emu.rx[i + 3]);
+			i += size;
+		} else {
+			emu.errors++;
+			i++;
+		}
+	}
+	memmove(emu.rx, emu.rx + i, emu.rx_len - i);
+	emu.rx_len -= i;
+}
+
+static void emu_report(double seconds, bool total)
+{
+	unsigned int i;
+	static unsigned long long bytes, dropped;
+	unsigned long long sent = 0, overrun = 0;
+	double line = emu.baud / EMU_BITS_PER_BYTE;
+
+	for (i = 0; i < EMU_MAX_STREAMS; i++) {
+		sent += streams[i].sent;
+		overrun += streams[i].overrun;
+		if (total && streams[i].sent > 0) {
+			fprintf(stdout, "[emu] %-8s %llu sent, %llu overrun\n",
+			        streams[i].name, streams[i].sent, streams[i].overrun);
+		}
+	}
+	if (total) {
+		fprintf(stdout,
+		    "[emu] %llu telegrams, %llu bytes, %llu dropped, %llu overrun, "
+		    "%llu pings, %llu configs, %llu checksum errors\n",
+		    sent, emu.bytes, emu.dropped, overrun, emu.pings, emu.configs,
+		    emu.errors);
+		return;
+	}
+	fprintf(stdout, "[emu] %.0f B/s (%.1f%% of line), %llu dropped\n",
+	    (emu.bytes - bytes) / seconds,
+	    line > 0 ? 100.0 * (emu.bytes - bytes) / seconds / line : 0.0,
+	    emu.dropped - dropped);
+	bytes = emu.bytes;
+	dropped = emu.dropped;
+}
+
+static bool emu_configure_tty(int fd)
+{
+	struct termios term;
+
+	if (tcgetattr(fd, &term) == -1) {
+		return false;
+	}
+	cfmakeraw(&term);
+	return tcsetattr(fd, TCSANOW, &term) == 0;
+}
+
+static bool emu_open(const char *dev)
+{
+	char *slave;
+
+	if (dev != NULL) {
+		emu.fd = open(dev, O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (emu.fd < 0) {
+			perror(dev);
+			return false;
+		}
+		return emu_configure_tty(emu.fd);
+	}
+	emu.fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (emu.fd < 0 || grantpt(emu.fd) == -1 || unlockpt(emu.fd) == -1 ||
+	    (slave = ptsname(emu.fd)) == NULL) {
+		perror("pty");
+		return false;
+	}
+	/* hold the slave open so the master does not hang up between runs */
+	emu.fd_hold = open(slave, O_RDWR | O_NOCTTY);
+	if (emu.fd_hold < 0 || !emu_configure_tty(emu.fd_hold)) {
+		perror(slave);
+		return false;
+	}
+	if (emu.link != NULL) {
+		unlink(emu.link);
+		if (symlink(slave, emu.link) == -1) {
+			perror(emu.link);
+			return false;
+		}
+	}
+	fprintf(stdout, "[emu] pty slave at %s\n",
+	        emu.link != NULL ? emu.link : slave);
+	fflush(stdout);
+	return true;
+}
+
+static bool emu_set_rate(char *arg)
+{
+	unsigned int i;
+	double rate;
+	char *eq = strchr(arg, '=');
+
+	if (eq == NULL) {
+		return false;
+	}
+	*eq = '\0';
+	rate = atof(eq + 1);
+	for (i = 0; i < EMU_MAX_STREAMS; i++) {
+		if (strcmp(arg, streams[i].name) == 0 || strcmp(arg, "all") == 0) {
+			streams[i].rate = rate;
+			if (strcmp(arg, "all") != 0) {
+				return true;
+			}
+		}
+	}
+	return strcmp(arg, "all") == 0;
+}
+
+static int usage(const char *progname)
+{
+	unsigned int i;
+
+	fprintf(stderr,
+		"Usage: %s [<options>]\n"
+		"Options:\n"
+		"  -d <dev>:	Attach to an existing tty or pty slave\n"
+		"  -l <link>:	Symlink the slave of a new pty to <link>\n"
+		"  -r <stream>=<hz>:	Telegram rate, repeatable, 'all' sets every stream\n"
+		"  -s:	Saturate the line with the selected streams (default ct)\n"
+		"  -b <baud>:	Line rate, 0 for unthrottled [%d]\n"
+		"  -t <seconds>:	Stop after <seconds>\n"
+		"  -v:	Increase verbosity\n"
+		"Streams:", progname, EMU_BAUD_DEFAULT);
+	for (i = 0; i < EMU_MAX_STREAMS; i++) {
+		fprintf(stderr, " %s", streams[i].name);
+	}
+	fprintf(stderr, "\n\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	unsigned int i;
+	bool any = false;
+	char *dev = NULL;
+	double duration = 0;
+	long long now, start, end = 0, report, ping = 0, wake;
+	struct timespec timeout;
+	struct pollfd pfd;
+	struct sigaction sa;
+
+	while ((opt = getopt(argc, argv, "b:d:hl:r:st:v")) != -1) {
+		switch (opt) {
+		case 'b':
+			emu.baud = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			dev = optarg;
+			break;
+		case 'l':
+			emu.link = optarg;
+			break;
+		case 'r':
+			if (!emu_set_rate(optarg)) {
+				return usage(argv[0]);
+			}
+			break;
+		case 's':
+			emu.saturate = true;
+			break;
+		case 't':
+			duration = atof(optarg);
+			break;
+		case 'v':
+			emu.verbosity++;
+			break;
+		case 'h':
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (!emu_open(dev)) {
+		return 2;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sighandler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	start = now = emu_now();
+	report = start + EMU_REPORT_INTERVAL;
+	if (duration > 0) {
+		end = start + (long long)(duration * EMU_NSEC);
+	}
+	if (emu.baud > 0) {
+		emu.byte_time = EMU_NSEC * EMU_BITS_PER_BYTE / emu.baud;
+	}
+	for (i = 0; i < EMU_MAX_STREAMS; i++) {
+		any |= streams[i].rate > 0;
+	}
+	if (emu.saturate && !any) {
+		streams[0].rate = 1; /* ct data */
+	}
+	for (i = 0; i < EMU_MAX_STREAMS; i++) {
+		if (streams[i].rate > 0 && !emu.saturate) {
+			streams[i].period = (long long)(EMU_NSEC / streams[i].rate);
+		}
+		streams[i].due = start;
+	}
+
+	while (!stop && (end == 0 || now < end)) {
+		if (!emu.configured && now >= ping) {
+			emu_send(FLX_TYPE_PING, NULL, 0);
+			ping = now + EMU_PING_INTERVAL;
+		}
+		emu_schedule(now);
+		if (now >= report) {
+			if (emu.verbosity > 0) {
+				emu_report((now - report + EMU_REPORT_INTERVAL) /
+				           (double)EMU_NSEC, false);
+			}
+			report = now + EMU_REPORT_INTERVAL;
+		}
+
+		wake = emu_next_event(now, report, ping);
+		if (end > 0 && end < wake) {
+			wake = end;
+		}
+		wake = wake > now ? wake - now : 0;
+		timeout.tv_sec = wake / EMU_NSEC;
+		timeout.tv_nsec = wake % EMU_NSEC;
+		pfd.fd = emu.fd;
+		pfd.events = POLLIN | (emu.tx_len > 0 ? POLLOUT : 0);
+		if (ppoll(&pfd, 1, &timeout, NULL) > 0) {
+			if (pfd.revents & POLLIN) {
+				emu_rx();
+			}
+			if (pfd.revents & POLLOUT) {
+				emu_flush();
+			}
+		}
+		now = emu_now();
+	}
+
+	emu_report(0, true);
+	if (emu.link != NULL && dev == NULL) {
+		unlink(emu.link);
+	}
+	close(emu.fd);
+	if (emu.fd_hold >= 0) {
+		close(emu.fd_hold);
+	}
+	return 0;
+}
@@ -25,6 +25,8 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 
+#include "fletcher.h"
+
 #define ENCODE_BUFFER_SIZE 128
 #define ENCODE_SYNC_TL_LEN 4
 #define ENCODE_FLETCHER16_LEN 2
@@ -37,21 +39,11 @@ struct encode_s {
 
 static inline unsigned short encode_fletcher16(unsigned char *data, size_t bytes)
 {
-	unsigned short sum1 = 0xff, sum2 = 0xff;
+	struct fletcher16 check;
 
-	while (bytes) {
-		size_t tlen = bytes > 20 ? 20 : bytes;
-		bytes -= tlen;
-		do {
-			sum2 += sum1 += *data++;
-		} while (--tlen);
-		sum1 = (sum1 & 0xff) + (sum1 >> 8);
-		sum2 = (sum2 & 0xff) + (sum2 >> 8);
-	}
-	/* Second reduction step to reduce sums to 8 bits */
-	sum1 = (sum1 & 0xff) + (sum1 >> 8);
-	sum2 = (sum2 & 0xff) + (sum2 >> 8);
-	return sum2 << 8 | sum1;
+	fletcher16_init(&check);
+	fletcher16_update(&check, data, bytes);
+	return fletcher16_final(&check);
 }
 
 static inline void encode_handler(struct encode_s *e, unsigned char *telegram)
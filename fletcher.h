@@ -0,0 +1,58 @@
+#ifndef FLETCHER_H
+#define FLETCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming fletcher16 as used on the FLX link: both sums start at 0xff and
+ * are kept modulo 255, with 0xff standing in for a zero residue. Bytes can be
+ * fed in any number of pieces, so a telegram is checked as it lands in the
+ * rx ring and only the last few bytes remain when it completes.
+ */
+#define FLETCHER16_BLOCK 5800 /* max bytes before sum2 can overflow 32 bits */
+
+struct fletcher16 {
+	uint32_t sum1;
+	uint32_t sum2;
+};
+
+static inline void fletcher16_init(struct fletcher16 *f)
+{
+	f->sum1 = 0xff;
+	f->sum2 = 0xff;
+}
+
+static inline void fletcher16_update(struct fletcher16 *f,
+                                     const unsigned char *data, size_t len)
+{
+	uint32_t sum1 = f->sum1, sum2 = f->sum2;
+
+	while (len) {
+		size_t block = len > FLETCHER16_BLOCK ? FLETCHER16_BLOCK : len;
+		len -= block;
+		/* four bytes per step without a sum1 -> sum2 dependency per byte */
+		for (; block >= 4; block -= 4, data += 4) {
+			sum2 += 4 * sum1 + 4 * data[0] + 3 * data[1] + 2 * data[2] +
+			        data[3];
+			sum1 += data[0] + data[1] + data[2] + data[3];
+		}
+		for (; block; block--) {
+			sum2 += sum1 += *data++;
+		}
+		sum1 %= 255;
+		sum2 %= 255;
+	}
+	f->sum1 = sum1;
+	f->sum2 = sum2;
+}
+
+/* sum2 in the high byte, sum1 in the low byte */
+static inline uint16_t fletcher16_final(const struct fletcher16 *f)
+{
+	uint32_t sum1 = f->sum1 % 255, sum2 = f->sum2 % 255;
+
+	return (uint16_t)((sum2 ? sum2 : 0xff) << 8 | (sum1 ? sum1 : 0xff));
+}
+
+#endif
@@ -22,19 +22,34 @@
  * SOFTWARE.
  */
 
+#include <assert.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
 #include <math.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <mosquitto.h>
 #include "binary.h"
+#include "bundle.h"
+#include "capture.h"
+#include "fmt.h"
+#include "history.h"
+#include "latest.h"
+#include "pub.h"
 #include "spin.h"
+#include "spool.h"
+#include "stream.h"
 #include "config.h"
 #include "shift.h"
 #include "flx.h"
+#include "payload.h"
 #include "decode.h"
 #include "encode.h"
 
@@ -42,14 +57,74 @@ const char* state2string[] = {
 	"sync1", "sync2", "head"
 };
 
+static struct flx_stats stats;
+static struct uloop_timeout rx_timer;
+
+static struct buffer_s rx = {
+	.head = 0,
+	.tail = 0,
+	.state = FLX_BUFFER_STATE_SYNC1,
+	.size = 0,
+	.data = NULL
+};
+
+/*
+ * map the same ring twice in a row; the mirror needs whole pages, so the ring
+ * is FLX_BUFFER_SIZE rounded up to the page size, still a power of two
+ */
+int flx_init(void)
+{
+	int fd;
+	char path[] = FLX_BUFFER_TMP;
+	unsigned char *ring;
+	long page = sysconf(_SC_PAGESIZE);
+	size_t size;
+
+	if (page <= 0 || (page & (page - 1)) != 0) {
+		fprintf(stderr, "[flx] unusable page size %ld\n", page);
+		return -1;
+	}
+	size = FLX_BUFFER_SIZE < (size_t)page ? (size_t)page : FLX_BUFFER_SIZE;
+	if ((fd = mkstemp(path)) < 0) {
+		perror("[flx] mkstemp");
+		return -1;
+	}
+	unlink(path);
+	if (ftruncate(fd, size) < 0) {
+		perror("[flx] ftruncate");
+		goto close;
+	}
+	/* reserve the address range first, then overlay both halves */
+	ring = mmap(NULL, 2 * size, PROT_NONE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED) {
+		perror("[flx] mmap");
+		goto close;
+	}
+	if (mmap(ring, size, PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	    mmap(ring + size, size, PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		perror("[flx] mmap");
+		munmap(ring, 2 * size);
+		goto close;
+	}
+	close(fd);
+	rx.size = size;
+	rx.data = ring;
+	return 0;
+
+close:
+	close(fd);
+	return -1;
+}
+
 static inline void flx_buffer_peek(struct buffer_s *b, unsigned char *peek)
 {
 	int i;
 	for (i = 0; i < FLX_BUFFER_PEEK_SIZE; i++) {
-		*(peek + 2 * i) =
-		    bin2hex[(b->data[(b->tail + i) % FLX_BUFFER_SIZE] & 0xf0) >> 4];
-		*(peek + 2 * i + 1) =
-		    bin2hex[b->data[(b->tail + i) % FLX_BUFFER_SIZE] & 0x0f];
+		*(peek + 2 * i) = bin2hex[(b->data[b->tail + i] & 0xf0) >> 4];
+		*(peek + 2 * i + 1) = bin2hex[b->data[b->tail + i] & 0x0f];
 	}
 	*(peek + FLX_BUFFER_PEEK_SIZE * 2) = 0;
 }
@@ -60,8 +135,8 @@ static void flx_buffer_dbg(struct buffer_s *b)
 	flx_buffer_peek(b, peek);
 	fprintf(stdout,
 	    "buffer[size:%d, fill:%d, head:%d, tail:%d, state:%s, peek:%s]\n",
-	    sizeof(b->data),
-		(FLX_BUFFER_SIZE + b->head - b->tail) % FLX_BUFFER_SIZE,
+	    b->size,
+		(b->head - b->tail) & (b->size - 1),
 	    b->head,
 	    b->tail,
 		state2string[b->state],
@@ -70,27 +145,37 @@ static void flx_buffer_dbg(struct buffer_s *b)
 
 static void flx_buffer_advance_head(struct buffer_s *b, size_t n)
 {
-	b->head = (b->head + n) % FLX_BUFFER_SIZE;
+	b->head = (b->head + n) & (b->size - 1);
 }
 
 static void flx_buffer_advance_tail(struct buffer_s *b, size_t n)
 {
-	b->tail = (b->tail + n) % FLX_BUFFER_SIZE;
+	b->tail = (b->tail + n) & (b->size - 1);
 }
 
 static size_t flx_buffer_fill(struct buffer_s *b)
 {
-	return (FLX_BUFFER_SIZE + b->head - b->tail) % FLX_BUFFER_SIZE;
+	return (b->head - b->tail) & (b->size - 1);
 }
 
 static size_t flx_buffer_max_read(struct buffer_s *b)
 {
-	size_t phy_free, log_free;
+	/* we don't want head == tail since that would indicate an empty buffer
+	 * writes past the physical end land in the mirror, i.e. at the start */
+	return b->size - flx_buffer_fill(b) - 1;
+}
 
-	/* we don't want head == tail since that would indicate an empty buffer */
-	log_free = FLX_BUFFER_SIZE - flx_buffer_fill(b) - 1;
-	phy_free = FLX_BUFFER_SIZE - b->head;
-	return (log_free < phy_free) ? log_free : phy_free;
+/*
+ * flx_pop() consumes every complete telegram and resyncs past anything
+ * else, so between reads the ring holds at most the start of one frame
+ * and is never full.
+ */
+static size_t flx_buffer_room(struct buffer_s *b)
+{
+	size_t room = flx_buffer_max_read(b);
+
+	assert(room >= b->size - FLX_FRAME_MAX - 1);
+	return room;
 }
 
 static int flx_buffer_is_empty(struct buffer_s *b)
@@ -98,27 +183,35 @@ static int flx_buffer_is_empty(struct buffer_s *b)
 	return b->head == b->tail;
 }
 
+/* fold whatever part of the type, length and payload has arrived so far */
+static inline void flx_check_update(struct buffer_s *b)
+{
+	size_t bytes = b->data[b->tail + 1] + 2;
+	size_t fill = flx_buffer_fill(b);
+	size_t upto = fill < bytes ? fill : bytes;
+
+	if (upto > b->checked) {
+		fletcher16_update(&b->check, &b->data[b->tail + b->checked],
+		                  upto - b->checked);
+		b->checked = upto;
+	}
+}
+
+static inline void flx_check_reset(struct buffer_s *b)
+{
+	fletcher16_init(&b->check);
+	b->checked = 0;
+}
+
 static inline int flx_check_fletcher16(struct buffer_s *b)
 {
-	size_t pos = b->tail;
-	size_t bytes = b->data[(b->tail + 1) % FLX_BUFFER_SIZE] + 2;
-	unsigned short sum1 = 0xff, sum2 = 0xff;
-
-	while (bytes) {
-		size_t tlen = bytes > 20 ? 20 : bytes;
-		bytes -= tlen;
-		do {
-			sum2 += sum1 += b->data[pos++];
-			pos %= FLX_BUFFER_SIZE;
-		} while (--tlen);
-		sum1 = (sum1 & 0xff) + (sum1 >> 8);
-		sum2 = (sum2 & 0xff) + (sum2 >> 8);
-	}
-	/* Second reduction step to reduce sums to 8 bits */
-	sum1 = (sum1 & 0xff) + (sum1 >> 8);
-	sum2 = (sum2 & 0xff) + (sum2 >> 8);
-
-	if (b->data[pos] == sum2 && b->data[(pos + 1) % FLX_BUFFER_SIZE] == sum1) {
+	unsigned char *frame = &b->data[b->tail];
+	size_t bytes = frame[1] + 2;
+	uint16_t check;
+
+	flx_check_update(b);
+	check = fletcher16_final(&b->check);
+	if (frame[bytes] == (check >> 8) && frame[bytes + 1] == (check & 0xff)) {
 		return 1;
 	}
 	return 0;
@@ -128,6 +221,9 @@ static void flx_decode(struct buffer_s *b)
 {
 	struct decode_s d;
 	unsigned char type = b->data[b->tail];
+	if (stream_wants(type)) {
+		stream_frame(type, decode_payload(b), decode_payload_len(b));
+	}
 	if (type >= FLX_MAX_TYPES || !decode_handler[type](b, &d)) {
 		return;
 	}
@@ -138,6 +234,17 @@ static void flx_decode(struct buffer_s *b)
 	}
 }
 
+/* skip ahead to the next sync byte, the fill is contiguous in the mirror */
+static void flx_buffer_scan(struct buffer_s *b)
+{
+	size_t fill = flx_buffer_fill(b);
+	unsigned char *sync = memchr(&b->data[b->tail], FLX_PROTO_SYNC, fill);
+	size_t skip = sync ? (size_t)(sync - &b->data[b->tail]) : fill;
+
+	stats.skipped += skip;
+	flx_buffer_advance_tail(b, skip);
+}
+
 static void flx_pop(struct buffer_s *b)
 {
 	size_t packet_size;
@@ -145,54 +252,235 @@ static void flx_pop(struct buffer_s *b)
 	while (!flx_buffer_is_empty(b)) {
 		switch (b->state) {
 		case FLX_BUFFER_STATE_SYNC1:
-			if (b->data[b->tail] == FLX_PROTO_SYNC) {
-				b->state = FLX_BUFFER_STATE_SYNC2;
+			flx_buffer_scan(b);
+			if (flx_buffer_is_empty(b)) {
+				return;
 			}
+			b->state = FLX_BUFFER_STATE_SYNC2;
 			flx_buffer_advance_tail(b, 1);
 			break;
 		case FLX_BUFFER_STATE_SYNC2:
 			if (b->data[b->tail] == FLX_PROTO_SYNC) {
 				b->state = FLX_BUFFER_STATE_HEAD;
+				flx_buffer_advance_tail(b, 1);
+				flx_check_reset(b);
 			} else {
+				/* lone sync byte, rescan from here */
 				b->state = FLX_BUFFER_STATE_SYNC1;
+				stats.skipped++;
 			}
-			flx_buffer_advance_tail(b, 1);
 			break;
 		case FLX_BUFFER_STATE_HEAD:
+			/* a run of more than two sync bytes, no type is that large */
+			if (b->data[b->tail] == FLX_PROTO_SYNC) {
+				stats.skipped++;
+				flx_buffer_advance_tail(b, 1);
+				break;
+			}
+			/* reject a false sync before waiting for its length's worth */
+			if (b->data[b->tail] >= FLX_MAX_TYPES) {
+				b->state = FLX_BUFFER_STATE_SYNC1;
+				break;
+			}
 			if (flx_buffer_fill(b) < 4) {
 				return;
 			}
-			packet_size = b->data[(b->tail + 1) % FLX_BUFFER_SIZE] + 4;
+			packet_size = b->data[b->tail + 1] + 4;
 			if (flx_buffer_fill(b) < packet_size) {
+				flx_check_update(b);
 				return;
 			}
+			b->state = FLX_BUFFER_STATE_SYNC1;
 			if (flx_check_fletcher16(b)) {
+				stats.frames++;
 				flx_decode(b);
-			} else if (conf.verbosity > 0) {
-				fprintf(stdout, "[flx] fletcher16 checksum error\n");
+				flx_buffer_advance_tail(b, packet_size);
+			} else {
+				/* the length byte itself may be corrupt, so rather than
+				 * skipping packet_size, resync on the next sync pair */
+				stats.errors++;
+				if (conf.verbosity > 0) {
+					fprintf(stdout, "[flx] fletcher16 checksum error\n");
+				}
 			}
-			b->state = FLX_BUFFER_STATE_SYNC1;
-			flx_buffer_advance_tail(b, packet_size);
 			break;
 		}
 	}
 }
 
+static double flx_cpu_time(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+	       usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+void flx_stats_init(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	decode_held = 0;
+	clock_gettime(CLOCK_MONOTONIC, &stats.start);
+	stats.cpu_start = flx_cpu_time();
+}
+
+void flx_stats_print(FILE *stream)
+{
+	double wall, cpu;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wall = (now.tv_sec - stats.start.tv_sec) +
+	       (now.tv_nsec - stats.start.tv_nsec) / 1e9;
+	cpu = flx_cpu_time() - stats.cpu_start;
+	fprintf(stream,
+	    "[flx] rx %llu bytes, %llu frames, %llu checksum errors in %.3fs\n"
+	    "[flx] %llu bytes skipped while hunting for sync\n"
+	    "[flx] %llu readings held back by a deadband\n"
+	    "[flx] %llu wakeups, %llu reads\n"
+	    "[flx] %.1f frames/s, cpu %.3fs, %.2f us/frame\n",
+	    stats.bytes,
+	    stats.frames,
+	    stats.errors,
+	    wall,
+	    stats.skipped,
+	    decode_held,
+	    stats.wakeups,
+	    stats.reads,
+	    wall > 0 ? stats.frames / wall : 0.0,
+	    cpu,
+	    stats.frames > 0 ? cpu * 1e6 / stats.frames : 0.0);
+}
+
+/*
+ * Read until the transport runs dry (EAGAIN), the ring fills up or
+ * FLX_RX_DRAIN_MAX reads have been issued, decoding after every read.
+ * Returns the number of bytes consumed, or -1 once the input has gone away.
+ */
+static ssize_t flx_drain(struct uloop_fd *ufd)
+{
+	int i;
+	ssize_t bytes_read, total = 0;
+
+	for (i = 0; i < FLX_RX_DRAIN_MAX; i++) {
+		bytes_read = read(ufd->fd, &rx.data[rx.head],
+		                  flx_buffer_room(&rx));
+		stats.reads++;
+		if (bytes_read < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytes_read < 0 && errno == EAGAIN) {
+			break;
+		}
+		if (bytes_read <= 0) {
+			/* EOF on a file or socket transport, or a dead tty */
+			if (bytes_read < 0) {
+				perror("[flx] read");
+			} else if (conf.verbosity > 0) {
+				fprintf(stdout, "[flx] end of input\n");
+			}
+			uloop_timeout_cancel(&rx_timer);
+			uloop_fd_delete(ufd);
+			uloop_end();
+			return -1;
+		}
+		capture_write(&rx.data[rx.head], bytes_read);
+		stats.bytes += bytes_read;
+		total += bytes_read;
+		flx_buffer_advance_head(&rx, bytes_read);
+		if (conf.verbosity > 2) {
+			flx_buffer_dbg(&rx);
+		}
+		flx_pop(&rx);
+	}
+	return total;
+}
+
+/*
+ * With a latency budget the fd is taken out of the poll set after a
+ * wakeup and the ring is drained again from a timer, so bytes that trickle
+ * in during the budget are picked up by one batch of reads instead of one
+ * wakeup each. Once a timer drain comes up empty, the line is idle and the
+ * fd goes back into the poll set.
+ */
+static void flx_rx_timer(struct uloop_timeout *t)
+{
+	ssize_t n;
+
+	stats.wakeups++;
+	n = flx_drain(&conf.flx_ufd);
+	if (n > 0) {
+		uloop_timeout_set(t, conf.flx_latency);
+	} else if (n == 0) {
+		uloop_fd_add(&conf.flx_ufd, ULOOP_READ);
+	}
+}
+
 void flx_rx(struct uloop_fd *ufd, unsigned int events)
 {
-	ssize_t bytes_read;
-	static struct buffer_s b = {
-		.head = 0,
-		.tail = 0,
-		.state = FLX_BUFFER_STATE_SYNC1
-	};
+	stats.wakeups++;
+	if (flx_drain(ufd) < 0 || conf.flx_latency == 0) {
+		return;
+	}
+	uloop_fd_delete(ufd);
+	rx_timer.cb = flx_rx_timer;
+	uloop_timeout_set(&rx_timer, conf.flx_latency);
+}
 
-	bytes_read = read(ufd->fd, &b.data[b.head], flx_buffer_max_read(&b));	
-	flx_buffer_advance_head(&b, bytes_read);
-	if (conf.verbosity > 2) {
-		flx_buffer_dbg(&b);
+/*
+ * epoll refuses a regular file, which never blocks anyway, so a file:
+ * transport is drained from a timer that yields to uloop between batches.
+ */
+static void flx_rx_file(struct uloop_timeout *t)
+{
+	stats.wakeups++;
+	if (flx_drain(&conf.flx_ufd) >= 0) {
+		uloop_timeout_set(t, 0);
 	}
-	flx_pop(&b);
+}
+
+bool flx_rx_start(struct uloop_fd *ufd)
+{
+	struct stat st;
+
+	if (fstat(ufd->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		rx_timer.cb = flx_rx_file;
+		uloop_timeout_set(&rx_timer, 0);
+		return true;
+	}
+	if (uloop_fd_add(ufd, ULOOP_READ) < 0) {
+		perror("[flx] uloop_fd_add");
+		return false;
+	}
+	return true;
+}
+
+/* push bytes that did not come from the transport, e.g. a capture replay */
+void flx_feed(const unsigned char *data, size_t len)
+{
+	size_t n;
+
+	while (len > 0) {
+		n = flx_buffer_room(&rx);
+		if (n > len) {
+			n = len;
+		}
+		memcpy(&rx.data[rx.head], data, n);
+		stats.bytes += n;
+		flx_buffer_advance_head(&rx, n);
+		if (conf.verbosity > 2) {
+			flx_buffer_dbg(&rx);
+		}
+		flx_pop(&rx);
+		data += n;
+		len -= n;
+	}
+}
+
+void flx_load_plan(void)
+{
+	decode_plan_build();
 }
 
 int flx_tx(unsigned char type, unsigned char *data, size_t len)
@@ -209,7 +497,7 @@ int flx_tx(unsigned char type, unsigned char *data, size_t len)
 		return -2;
 	}
 	encode_handler(&e, telegram);
-	return write(conf.flx_ufd.fd, telegram, len + ENCODE_SYNC_TL_LEN +
-	      ENCODE_FLETCHER16_LEN);
+	return transport_write(&conf.transport, telegram, len +
+	       ENCODE_SYNC_TL_LEN + ENCODE_FLETCHER16_LEN);
 }
 
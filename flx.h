@@ -25,11 +25,18 @@
 #ifndef FLX_H
 #define FLX_H
 
+#include <stdio.h>
+#include <time.h>
 #include <libubox/uloop.h>
+#include "fletcher.h"
 
 #define FLX_DEV "/dev/ttyATH0"
-#define FLX_BUFFER_SIZE 1024
+#define FLX_BUFFER_SIZE 4096 /* power of two, rounded up to the page size */
+#define FLX_BUFFER_TMP "/tmp/flx.ring.XXXXXX"
 #define FLX_BUFFER_PEEK_SIZE 4
+#define FLX_FRAME_MAX (255 + 4) /* type, length, payload and checksum */
+#define FLX_RX_DRAIN_MAX 16 /* reads per wakeup before yielding to uloop */
+#define FLX_LATENCY_MAX 50 /* ms, well below the time to fill the ring */
 #define FLX_PROTO_SYNC 0xaa
 #define FLX_KUBE_MAX_PACKET_SIZE (66 + 5)
 
@@ -64,11 +71,35 @@ struct buffer_s {
 	size_t head;
 	size_t tail;
 	enum flx_buffer_state state;
-    /* unsigned qualifier needed for comparison with FLX_PROTO_SYNC */
-	unsigned char data[FLX_BUFFER_SIZE];
+	/* power of two, set by flx_init() */
+	size_t size;
+	/* running checksum over the first checked bytes of the frame at tail */
+	struct fletcher16 check;
+	size_t checked;
+	/* unsigned qualifier needed for comparison with FLX_PROTO_SYNC
+	 * the ring is mapped twice back to back, so data[tail .. tail + n) is
+	 * contiguous for any n <= size, wrapped or not */
+	unsigned char *data;
 };
 
+struct flx_stats {
+	unsigned long long bytes;
+	unsigned long long frames;
+	unsigned long long errors;
+	unsigned long long skipped;
+	unsigned long long wakeups;
+	unsigned long long reads;
+	struct timespec start;
+	double cpu_start;
+};
+
+int flx_init(void);
+void flx_stats_init(void);
+void flx_stats_print(FILE *stream);
 void flx_rx(struct uloop_fd *ufd, unsigned int events);
+bool flx_rx_start(struct uloop_fd *ufd);
+void flx_feed(const unsigned char *data, size_t len);
+void flx_load_plan(void);
 int flx_tx(unsigned char type, unsigned char *data, size_t len);
 
 #endif
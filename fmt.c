@@ -0,0 +1,87 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "fmt.h"
+
+/* "00" .. "99", so every division by 100 yields two digits */
+static const char fmt_digits2[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static char *fmt_u32_digits(char *p, uint32_t v, int width)
+{
+	char tmp[FMT_U32_MAX];
+	char *t = tmp + sizeof(tmp);
+	int n;
+
+	while (v >= 100) {
+		uint32_t r = v % 100;
+		v /= 100;
+		*--t = fmt_digits2[2 * r + 1];
+		*--t = fmt_digits2[2 * r];
+	}
+	if (v >= 10) {
+		*--t = fmt_digits2[2 * v + 1];
+		*--t = fmt_digits2[2 * v];
+	} else {
+		*--t = '0' + v;
+	}
+	for (n = tmp + sizeof(tmp) - t; n < width; n++) {
+		*p++ = '0';
+	}
+	while (t < tmp + sizeof(tmp)) {
+		*p++ = *t++;
+	}
+	return p;
+}
+
+char *fmt_u32(char *p, uint32_t v)
+{
+	return fmt_u32_digits(p, v, 0);
+}
+
+char *fmt_u32_pad(char *p, uint32_t v, int width)
+{
+	return fmt_u32_digits(p, v, width);
+}
+
+char *fmt_i32(char *p, int32_t v)
+{
+	if (v < 0) {
+		*p++ = '-';
+		return fmt_u32_digits(p, -(uint32_t)v, 0);
+	}
+	return fmt_u32_digits(p, v, 0);
+}
+
+char *fmt_str(char *p, const char *s)
+{
+	while (*s) {
+		*p++ = *s++;
+	}
+	return p;
+}
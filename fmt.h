@@ -0,0 +1,26 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <stdint.h>
+
+/*
+ * Integer to ASCII helpers for building telegram payloads without
+ * snprintf. Each call writes at the cursor and returns the new cursor, no
+ * terminating NUL. The caller sizes the buffer: a 32-bit value takes at most
+ * FMT_I32_MAX characters.
+ */
+#define FMT_U32_MAX 10 /* 4294967295 */
+#define FMT_I32_MAX 11 /* -2147483648 */
+
+char *fmt_u32(char *p, uint32_t v);
+char *fmt_u32_pad(char *p, uint32_t v, int width); /* like %0<width>u */
+char *fmt_i32(char *p, int32_t v);
+char *fmt_str(char *p, const char *s);
+
+static inline char *fmt_chr(char *p, char c)
+{
+	*p++ = c;
+	return p;
+}
+
+#endif
@@ -0,0 +1,457 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "history.h"
+
+#define HISTORY_PATH_NEW ".new" /* built next to the file, then renamed */
+
+struct history_file {
+	uint32_t magic;
+	uint32_t step;
+	uint32_t slots;
+	uint32_t series;
+	uint32_t reserved[4];
+};
+
+/* sensor id and kind the series was recorded for */
+struct history_series {
+	char id[CONFIG_STR_MAX];
+	uint32_t kind;
+	uint32_t reserved;
+};
+
+struct history_slot {
+	uint32_t time; /* start of the slot, stale unless it matches */
+	uint32_t count;
+	int64_t value; /* last counter reading, or sum of gauge readings */
+};
+
+struct history_map {
+	int fd;
+	size_t size;
+	struct history_file *file;
+	struct history_series *series;
+	struct history_slot *slot;
+};
+
+static struct {
+	char path[CONFIG_STR_MAX];
+	struct history_map map;
+	bool want[CONFIG_MAX_SENSORS][HISTORY_KINDS]; /* in the decode plan */
+	int series[CONFIG_MAX_SENSORS][HISTORY_KINDS]; /* index, or -1 */
+	const char *unit[CONFIG_MAX_SENSORS][HISTORY_KINDS];
+	unsigned long long added;
+	unsigned long long queries;
+} history = {
+	.map = {
+		.fd = -1
+	}
+};
+
+static size_t history_size(uint32_t slots, uint32_t series)
+{
+	return sizeof(struct history_file) +
+	       series * sizeof(struct history_series) +
+	       (size_t)series * slots * sizeof(struct history_slot);
+}
+
+static struct history_slot *history_ring(const struct history_map *m,
+                                         int series)
+{
+	return m->slot + (size_t)series * m->file->slots;
+}
+
+static void history_unmap(struct history_map *m)
+{
+	if (m->file != NULL) {
+		munmap(m->file, m->size);
+		m->file = NULL;
+	}
+	if (m->fd >= 0) {
+		close(m->fd);
+		m->fd = -1;
+	}
+}
+
+static bool history_mmap(struct history_map *m, const char *path, int fd,
+                         size_t size, uint32_t series)
+{
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	                 fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED) {
+		perror(path[0] != '\0' ? path : "mmap");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+	m->fd = fd;
+	m->size = size;
+	m->file = map;
+	m->series = (struct history_series *)(m->file + 1);
+	m->slot = (struct history_slot *)(m->series + series);
+	return true;
+}
+
+/* the history left in a file by a previous run, if any */
+static bool history_attach(struct history_map *m, const char *path)
+{
+	int fd;
+	struct stat st;
+	struct history_file f;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		return false;
+	}
+	if (fstat(fd, &st) < 0 || pread(fd, &f, sizeof(f), 0) != sizeof(f) ||
+	    f.magic != HISTORY_MAGIC || f.step == 0 || f.slots == 0 ||
+	    (size_t)st.st_size != history_size(f.slots, f.series)) {
+		close(fd);
+		return false;
+	}
+	return history_mmap(m, path, fd, st.st_size, f.series);
+}
+
+/* a zero filled mapping, so every slot starts out stale */
+static bool history_create(struct history_map *m, const char *path,
+                           uint32_t step, uint32_t slots, uint32_t series)
+{
+	int fd = -1;
+	size_t size = history_size(slots, series);
+	struct history_file f = {
+		.step = step,
+		.slots = slots,
+		.series = series
+	};
+
+	if (path[0] != '\0') {
+		fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0 || ftruncate(fd, size) < 0 ||
+		    pwrite(fd, &f, sizeof(f), 0) != sizeof(f)) {
+			perror(path);
+			if (fd >= 0) {
+				close(fd);
+			}
+			return false;
+		}
+	}
+	if (!history_mmap(m, path, fd, size, series)) {
+		return false;
+	}
+	*m->file = f;
+	return true;
+}
+
+/* fold count readings of a slot starting at time into a ring */
+static void history_merge(struct history_slot *ring, uint32_t step,
+                          uint32_t slots, enum history_kind kind,
+                          uint32_t time, uint32_t count, int64_t value)
+{
+	uint32_t start = time - time % step;
+	struct history_slot *slot = ring + time / step % slots;
+
+	if (slot->time != start || slot->count == 0) {
+		slot->time = start;
+		slot->count = 0;
+		slot->value = 0;
+	}
+	slot->value = kind == HISTORY_GAUGE ? slot->value + value : value;
+	slot->count += count;
+}
+
+/* oldest first, so a counter ends up with its latest reading */
+static void history_copy(const struct history_map *from, int i,
+                         const struct history_map *to, int j)
+{
+	uint32_t t, newest = 0, step = from->file->step;
+	const struct history_slot *ring = history_ring(from, i), *slot;
+	uint32_t span = (from->file->slots - 1) * step;
+
+	for (slot = ring; slot < ring + from->file->slots; slot++) {
+		if (slot->count > 0 && slot->time > newest) {
+			newest = slot->time;
+		}
+	}
+	for (t = newest - (newest > span ? span : newest); ; t += step) {
+		slot = ring + t / step % from->file->slots;
+		if (slot->time == t && slot->count > 0) {
+			history_merge(history_ring(to, j), to->file->step,
+			              to->file->slots, to->series[j].kind, t,
+			              slot->count, slot->value);
+		}
+		if (t >= newest) {
+			break;
+		}
+	}
+}
+
+static void history_migrate(const struct history_map *from,
+                            const struct history_map *to)
+{
+	uint32_t i, j;
+
+	for (j = 0; j < to->file->series; j++) {
+		for (i = 0; i < from->file->series; i++) {
+			if (from->series[i].kind == to->series[j].kind &&
+			    strcmp(from->series[i].id, to->series[j].id) == 0) {
+				history_copy(from, i, to, j);
+				break;
+			}
+		}
+	}
+}
+
+void history_plan_clear(void)
+{
+	memset(history.want, 0, sizeof(history.want));
+}
+
+void history_plan_add(int sensor, enum history_kind kind)
+{
+	history.want[sensor][kind] = true;
+}
+
+/* does the mapping hold exactly the series the plan asks for, in order */
+static bool history_fits(const struct history_map *m, uint32_t step,
+                         uint32_t slots, uint32_t series)
+{
+	int i, kind;
+	uint32_t j = 0;
+
+	if (m->file == NULL || m->file->step != step || m->file->slots != slots ||
+	    m->file->series != series) {
+		return false;
+	}
+	for (i = 0; i < CONFIG_MAX_SENSORS; i++) {
+		for (kind = 0; kind < HISTORY_KINDS; kind++) {
+			if (!history.want[i][kind]) {
+				continue;
+			}
+			if (m->series[j].kind != (uint32_t)kind ||
+			    strcmp(m->series[j].id, conf.sensor[i].id) != 0) {
+				return false;
+			}
+			j++;
+		}
+	}
+	return true;
+}
+
+/*
+ * keep is the s of history per series, 0 to disable. Call it after the
+ * decode plan is built. A reload rebuilds the rings only if the plan, a
+ * sensor id or the ring size changed, and carries the history of every
+ * sensor that is still there over to the new ones.
+ */
+bool history_open(const char *path, unsigned int keep, unsigned int step)
+{
+	int i, kind;
+	uint32_t j, slots, slots_max, series = 0;
+	char path_new[CONFIG_STR_MAX + sizeof(HISTORY_PATH_NEW)] = "";
+	struct history_map old = { .fd = -1 }, m = { .fd = -1 };
+
+	for (i = 0; i < CONFIG_MAX_SENSORS; i++) {
+		for (kind = 0; kind < HISTORY_KINDS; kind++) {
+			history.series[i][kind] = -1;
+			series += history.want[i][kind];
+		}
+	}
+	if (keep == 0 || series == 0) {
+		history_close();
+		return true;
+	}
+	step = step > 0 ? step : HISTORY_STEP_DEFAULT;
+	slots = (keep + step - 1) / step;
+	slots_max = (HISTORY_BYTES_MAX - history_size(0, series)) /
+	            (series * sizeof(struct history_slot));
+	if (slots > slots_max) {
+		slots = slots_max;
+		fprintf(stderr, "[history] %u s do not fit, keeping %u s\n", keep,
+		        slots * step);
+	}
+
+	if (strcmp(history.path, path) == 0 &&
+	    history_fits(&history.map, step, slots, series)) {
+		m = history.map;
+	} else {
+		/* what is mapped now, or else what a previous run left behind */
+		old = history.map;
+		history.map.file = NULL;
+		history.map.fd = -1;
+		if (old.file == NULL && path[0] != '\0') {
+			history_attach(&old, path);
+		}
+		if (path[0] != '\0') {
+			snprintf(path_new, sizeof(path_new), "%s" HISTORY_PATH_NEW, path);
+		}
+		if (!history_create(&m, path_new, step, slots, series)) {
+			history_unmap(&old);
+			history.path[0] = '\0';
+			return false;
+		}
+		for (i = 0, j = 0; i < CONFIG_MAX_SENSORS; i++) {
+			for (kind = 0; kind < HISTORY_KINDS; kind++) {
+				if (history.want[i][kind]) {
+					strncpy(m.series[j].id, conf.sensor[i].id,
+					        CONFIG_STR_MAX - 1);
+					m.series[j++].kind = kind;
+				}
+			}
+		}
+		if (old.file != NULL) {
+			history_migrate(&old, &m);
+			history_unmap(&old);
+		}
+		m.file->magic = HISTORY_MAGIC;
+		if (path_new[0] != '\0' && rename(path_new, path) < 0) {
+			perror(path);
+		}
+		history.map = m;
+		strncpy(history.path, path, CONFIG_STR_MAX - 1);
+	}
+	for (i = 0, j = 0; i < CONFIG_MAX_SENSORS; i++) {
+		for (kind = 0; kind < HISTORY_KINDS; kind++) {
+			if (history.want[i][kind]) {
+				history.series[i][kind] = j++;
+			}
+		}
+	}
+	return true;
+}
+
+void history_close(void)
+{
+	int i, kind;
+
+	history_unmap(&history.map);
+	history.path[0] = '\0';
+	for (i = 0; i < CONFIG_MAX_SENSORS; i++) {
+		for (kind = 0; kind < HISTORY_KINDS; kind++) {
+			history.series[i][kind] = -1;
+		}
+	}
+}
+
+void history_add(int sensor, enum history_kind kind, const char *unit,
+                 uint32_t time, int64_t milli)
+{
+	const struct history_map *m = &history.map;
+
+	if (m->file == NULL || history.series[sensor][kind] < 0) {
+		return;
+	}
+	history_merge(history_ring(m, history.series[sensor][kind]),
+	              m->file->step, m->file->slots, kind, time, 1, milli);
+	history.unit[sensor][kind] = unit;
+	history.added++;
+}
+/*
+ * Fill point with one entry per step between start and end that has
+ * readings, at most HISTORY_POINTS_MAX. step is rounded up to a multiple
+ * of the slot width, and further if the range would not fit. Returns the
+ * number of points, or -1 for a sensor without history.
+ */
+int history_query(int sensor, enum history_kind kind, uint32_t start,
+                  uint32_t end, unsigned int *step, const char **unit,
+                  struct history_point *point)
+{
+	int n = 0;
+	bool have;
+	int64_t last, sum;
+	uint32_t width, span, oldest, bucket, t, count;
+	const struct history_map *m = &history.map;
+	const struct history_slot *ring, *slot;
+
+	if (m->file == NULL || sensor < 0 || sensor >= CONFIG_MAX_SENSORS ||
+	    kind >= HISTORY_KINDS || history.series[sensor][kind] < 0) {
+		return -1;
+	}
+	history.queries++;
+	*unit = history.unit[sensor][kind];
+	width = m->file->step;
+	span = width * m->file->slots;
+	oldest = end - end % width;
+	oldest = oldest >= span ? oldest - span + width : 0;
+	start = start < oldest ? oldest : start;
+	if (start > end) {
+		return 0;
+	}
+	if (*step < width) {
+		*step = width;
+	}
+	if ((end - start) / *step >= HISTORY_POINTS_MAX) {
+		*step = (end - start) / HISTORY_POINTS_MAX + 1;
+	}
+	*step = (*step + width - 1) / width * width;
+	ring = history_ring(m, history.series[sensor][kind]);
+	for (bucket = start - start % *step; bucket <= end && n < HISTORY_POINTS_MAX;
+	     bucket += *step) {
+		have = false;
+		last = sum = 0;
+		count = 0;
+		for (t = bucket; t < bucket + *step && t <= end; t += width) {
+			slot = ring + t / width % m->file->slots;
+			if (t < start - start % width || slot->time != t ||
+			    slot->count == 0) {
+				continue;
+			}
+			have = true;
+			last = slot->value;
+			sum += slot->value;
+			count += slot->count;
+		}
+		if (have) {
+			point[n].time = bucket;
+			point[n].value = kind == HISTORY_GAUGE ? sum / count : last;
+			n++;
+		}
+		if (bucket > UINT32_MAX - *step) {
+			break;
+		}
+	}
+	return n;
+}
+
+void history_stats_print(FILE *stream)
+{
+	const struct history_file *f = history.map.file;
+
+	if (f == NULL) {
+		return;
+	}
+	fprintf(stream,
+	    "[history] %llu readings, %llu queries, %u series of %u slots\n",
+	    history.added, history.queries, f->series, f->slots);
+}
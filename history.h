@@ -0,0 +1,52 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Recent sensor readings, kept on the device so local consumers can ask
+ * for the last hour without a round trip through the broker. Every counter
+ * and gauge in the decode plan has a series: a ring of slots indexed by
+ * time / step, so a reading lands in its slot without any search and a
+ * slot older than the ring is simply overwritten. A slot holds the last
+ * counter reading, or the sum and count of the gauge readings in it.
+ *
+ * All rings together stay within HISTORY_BYTES_MAX, fewer seconds are
+ * kept if flx.main.history asks for more. They live in an anonymous
+ * mapping, or in flx.main.history_file to survive a restart of the daemon.
+ * That is meant for tmpfs: the kernel writes the pages back whenever it
+ * likes. When a reload changes the plan or the ring size, the history of
+ * every sensor whose id did not change moves over to the new rings.
+ */
+#define HISTORY_MAGIC			0x464c5848 /* FLXH */
+#define HISTORY_STEP_DEFAULT	10 /* s per slot */
+#define HISTORY_BYTES_MAX		(2 * 1024 * 1024) /* of all rings together */
+#define HISTORY_POINTS_MAX		1024 /* per query, the step grows to fit */
+#define HISTORY_SPAN_DEFAULT	3600 /* s queried without a start */
+
+enum history_kind {
+	HISTORY_COUNTER,
+	HISTORY_GAUGE,
+	HISTORY_KINDS
+};
+
+/* value in 1/1000 of the unit, the mean over the step for gauges */
+struct history_point {
+	uint32_t time;
+	int64_t value;
+};
+
+void history_plan_clear(void);
+void history_plan_add(int sensor, enum history_kind kind);
+bool history_open(const char *path, unsigned int keep, unsigned int step);
+void history_close(void);
+void history_add(int sensor, enum history_kind kind, const char *unit,
+                 uint32_t time, int64_t milli);
+int history_query(int sensor, enum history_kind kind, uint32_t start,
+                  uint32_t end, unsigned int *step, const char **unit,
+                  struct history_point *point);
+void history_stats_print(FILE *stream);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "config.h"
+#include "latest.h"
+
+static struct {
+	int fd;
+	size_t map_size;
+	char path[CONFIG_STR_MAX];
+	struct latest_file *file;
+} latest = {
+	.fd = -1
+};
+
+/* the only writer, so the count can be read without atomics */
+static struct latest_value *latest_begin(int sensor)
+{
+	struct latest_entry *e = &latest.file->entry[sensor];
+
+	__atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return &e->value;
+}
+
+static void latest_end(int sensor)
+{
+	struct latest_entry *e = &latest.file->entry[sensor];
+
+	__atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* entries whose sensor id changed start over */
+static void latest_load_ids(void)
+{
+	int i;
+	struct latest_value *v;
+	const char *id;
+
+	for (i = 0; i < CONFIG_MAX_SENSORS; i++) {
+		id = conf.sensor[i].enable ? conf.sensor[i].id : "";
+		if (strncmp(latest.file->entry[i].value.id, id,
+		            LATEST_ID_MAX) == 0) {
+			continue;
+		}
+		v = latest_begin(i);
+		memset(v, 0, sizeof(*v));
+		strncpy(v->id, id, LATEST_ID_MAX - 1);
+		latest_end(i);
+	}
+}
+
+bool latest_open(const char *path)
+{
+	void *map;
+	struct latest_file *f;
+
+	if (latest.file != NULL && strcmp(latest.path, path) == 0) {
+		latest_load_ids();
+		return true;
+	}
+	latest_close();
+	latest.map_size = sizeof(*f) +
+	                  CONFIG_MAX_SENSORS * sizeof(struct latest_entry);
+	latest.fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (latest.fd < 0 || ftruncate(latest.fd, latest.map_size) < 0) {
+		perror(path);
+		latest_close();
+		return false;
+	}
+	map = mmap(NULL, latest.map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	           latest.fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		latest_close();
+		return false;
+	}
+	f = latest.file = map;
+	/* readers hold off until the magic is back */
+	__atomic_store_n(&f->magic, 0, __ATOMIC_RELEASE);
+	memset(f->entry, 0, CONFIG_MAX_SENSORS * sizeof(struct latest_entry));
+	f->version = LATEST_VERSION;
+	f->sensors = CONFIG_MAX_SENSORS;
+	f->entry_size = sizeof(struct latest_entry);
+	f->pid = getpid();
+	latest_load_ids();
+	__atomic_store_n(&f->magic, LATEST_MAGIC, __ATOMIC_RELEASE);
+	strncpy(latest.path, path, CONFIG_STR_MAX - 1);
+	return true;
+}
+
+/* the file stays, with the last readings and the pid of a gone writer */
+void latest_close(void)
+{
+	if (latest.file != NULL) {
+		munmap(latest.file, latest.map_size);
+		latest.file = NULL;
+	}
+	if (latest.fd >= 0) {
+		close(latest.fd);
+		latest.fd = -1;
+	}
+	latest.path[0] = '\0';
+}
+
+void latest_counter(int sensor, const char *unit, uint32_t time,
+                    int64_t milli)
+{
+	struct latest_value *v;
+
+	if (latest.file == NULL) {
+		return;
+	}
+	v = latest_begin(sensor);
+	strncpy(v->counter_unit, unit, LATEST_UNIT_MAX - 1);
+	v->counter_time = time;
+	v->counter = milli;
+	latest_end(sensor);
+}
+
+void latest_gauge(int sensor, const char *unit, uint32_t time, int64_t milli)
+{
+	struct latest_value *v;
+
+	if (latest.file == NULL) {
+		return;
+	}
+	v = latest_begin(sensor);
+	strncpy(v->gauge_unit, unit, LATEST_UNIT_MAX - 1);
+	v->gauge_time = time;
+	v->gauge = milli;
+	latest_end(sensor);
+}
@@ -0,0 +1,84 @@
+#ifndef LATEST_H
+#define LATEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The latest counter and gauge of every sensor, in a file under /dev/shm
+ * that local processes map read-only, instead of subscribing to the broker
+ * for the current power. Entries are indexed like conf.sensor[], and each
+ * is guarded by its own sequence count: flxd makes it odd while it writes
+ * the entry and even again when done, so a reader copies the entry and
+ * retries if the count was odd or changed meanwhile. Reading takes no
+ * syscalls and no locks, and never stalls the writer.
+ *
+ * This header is all a reader needs, see latest_read().
+ */
+#define LATEST_MAGIC		0x464c584c /* FLXL */
+#define LATEST_VERSION		1
+#define LATEST_ID_MAX		64
+#define LATEST_UNIT_MAX		8
+#define LATEST_READ_TRIES	1000 /* then the writer died halfway */
+
+/* readings in 1/1000 of their unit, time 0 until the first one */
+struct latest_value {
+	char id[LATEST_ID_MAX]; /* empty for a disabled sensor */
+	char counter_unit[LATEST_UNIT_MAX];
+	char gauge_unit[LATEST_UNIT_MAX];
+	uint32_t counter_time;
+	uint32_t gauge_time;
+	int64_t counter;
+	int64_t gauge;
+};
+
+struct latest_entry {
+	uint32_t seq;
+	uint32_t reserved;
+	struct latest_value value;
+	uint32_t pad[4]; /* to 128 bytes, two entries never share a line */
+};
+
+struct latest_file {
+	uint32_t magic; /* written last, once the table is ready */
+	uint32_t version;
+	uint32_t sensors;
+	uint32_t entry_size;
+	uint32_t pid; /* of the writer */
+	uint32_t reserved[3];
+	struct latest_entry entry[];
+};
+
+bool latest_open(const char *path);
+void latest_close(void);
+void latest_counter(int sensor, const char *unit, uint32_t time,
+                    int64_t milli);
+void latest_gauge(int sensor, const char *unit, uint32_t time, int64_t milli);
+
+/* copy the entry of a sensor, false if there is none or no stable copy */
+static inline bool latest_read(const struct latest_file *f,
+                               unsigned int sensor, struct latest_value *v)
+{
+	int tries;
+	uint32_t seq;
+	const struct latest_entry *e;
+
+	if (__atomic_load_n(&f->magic, __ATOMIC_ACQUIRE) != LATEST_MAGIC ||
+	    sensor >= f->sensors) {
+		return false;
+	}
+	e = (const struct latest_entry *)((const char *)f->entry +
+	                                  sensor * f->entry_size);
+	for (tries = 0; tries < LATEST_READ_TRIES; tries++) {
+		seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		memcpy(v, &e->value, sizeof(*v));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!(seq & 1) && seq == __atomic_load_n(&e->seq, __ATOMIC_RELAXED)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif
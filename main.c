@@ -23,6 +23,7 @@
  */
 
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -30,13 +31,21 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
-#include <termios.h>
+#include <poll.h>
+#include <time.h>
 #include <mosquitto.h>
 #include <stdint.h>
 #include "binary.h"
+#include "bundle.h"
+#include "capture.h"
 #include "config.h"
 #include "flx.h"
+#include "history.h"
+#include "latest.h"
+#include "pub.h"
 #include "shift.h"
+#include "spool.h"
+#include "stream.h"
 
 struct config conf;
 
@@ -45,35 +54,18 @@ static void sighandler(int sig)
 	uloop_end();
 }
 
-static bool configure_tty(int fd)
-{
-	struct termios term;
-
-	if (tcgetattr(fd, &term) == -1) {
-		return false;
-	}
-	if (cfsetospeed(&term, B460800) == -1) {
-		return false;
-	}
-	/* configure tty in raw mode */
-	term.c_iflag &= ~(BRKINT | ICRNL | IGNBRK | IGNCR | INLCR | INPCK |
-	                  ISTRIP | IXOFF | IXON | PARMRK);
-	term.c_oflag &= ~OPOST;
-	term.c_cflag &= ~PARENB;
-	term.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
-	term.c_cc[VMIN] = 1;
-	term.c_cc[VTIME] = 0;
-	if (tcsetattr(fd, TCSAFLUSH, &term) == -1) {
-		return false;
-	}
-	return true;
-}
-
 static int usage(const char *progname)
 {
 	fprintf(stderr,
 		"Usage: %s [<options>]\n"
 		"Options:\n"
+		"  -d <transport>:	Sensor board transport [" FLX_DEV "]\n"
+		"           	tty:<dev>, pty[:<link>], unix:<socket>, file:<path>\n"
+		"           	or replay:<capture>\n"
+		"  -w <capture>:	Record all serial traffic to a capture file\n"
+		"  -p <pace>:	Replay speed factor, 0 for max speed [1]\n"
+		"  -l <ms>:	Coalesce serial wakeups for up to <ms> ms [0]\n"
+		"  -s:	Run mosquitto on the main loop, without threads\n"
 		"  -v:	Increase verbosity\n"
 		"\n", progname);
 	return 1;
@@ -97,9 +89,32 @@ static void mosq_on_connect_cb(struct mosquitto *mosq, void *obj, int rc)
 #ifdef WITH_YKW
 		mosquitto_subscribe(mosq, NULL, conf.topic_ykw_config_push, 0);
 #endif
+		pub_forget_pending(mosq);
+		spool_set_link(SPOOL_LINK_BROKER, true);
 	}
 }
 
+static void mosq_on_disconnect_cb(struct mosquitto *mosq, void *obj, int rc)
+{
+	if (conf.verbosity > 0) {
+		fprintf(stdout, "[mosq] disconnected from broker (%d)\n", rc);
+	}
+	pub_forget_pending(mosq);
+	spool_set_link(SPOOL_LINK_BROKER, false);
+}
+
+static void mosq_on_publish_cb(struct mosquitto *mosq, void *obj, int mid)
+{
+	pub_on_publish(mosq, obj, mid);
+	spool_on_publish(mid);
+}
+
+/* the bulk connection only matters for the backlog */
+static void mosq_bulk_on_link_cb(struct mosquitto *mosq, void *obj, int rc)
+{
+	pub_forget_pending(mosq);
+}
+
 static void mosq_on_message_cb(struct mosquitto *mosq, void *obj,
                                const struct mosquitto_message *message)
 {
@@ -108,7 +123,11 @@ static void mosq_on_message_cb(struct mosquitto *mosq, void *obj,
 			fprintf(stdout, "[mosq] rx %s: %.1s\n", message->topic,
 			        (char *)message->payload);
 		}
-		write(conf.fd_globe, message->payload, 1);
+		if (conf.fd_globe >= 0) {
+			write(conf.fd_globe, message->payload, 1);
+		}
+		spool_set_link(SPOOL_LINK_BRIDGE, message->payloadlen > 0 &&
+		               ((char *)message->payload)[0] == '1');
 #ifdef WITH_YKW
 	} else if (strcmp(message->topic, conf.topic_ykw_config_push) == 0) {
 		if (conf.verbosity > 0) {
@@ -121,6 +140,190 @@ static void mosq_on_message_cb(struct mosquitto *mosq, void *obj,
 	}
 }
 
+/*
+ * Single-threaded mode: each mosquitto socket is a uloop fd and a timer
+ * runs the keepalive and reconnects, so the mosquitto callbacks run on the
+ * uloop thread together with everything else. Publishes are written out
+ * straight away by mosquitto_publish(), write interest is only needed
+ * while the socket is backed up. Whatever it could not write is picked up
+ * by mosq_flush, armed by every publish and run once the current uloop
+ * callback is done.
+ */
+struct mosq_link {
+	struct mosquitto **mosq;
+	struct uloop_fd ufd;
+};
+
+static struct mosq_link mosq_link[] = {
+	{ .mosq = &conf.mosq, .ufd = { .fd = -1 } },
+	{ .mosq = &conf.mosq_bulk, .ufd = { .fd = -1 } }
+};
+#define MOSQ_LINKS (sizeof(mosq_link) / sizeof(mosq_link[0]))
+static struct uloop_timeout mosq_timer;
+static struct uloop_timeout mosq_flush;
+
+/* follow the socket across reconnects, only touch uloop on a change */
+static void mosq_events(struct mosq_link *l)
+{
+	int fd = mosquitto_socket(*l->mosq);
+	unsigned int flags;
+
+	if (fd != l->ufd.fd && l->ufd.registered) {
+		uloop_fd_delete(&l->ufd);
+	}
+	l->ufd.fd = fd;
+	if (fd < 0) {
+		return;
+	}
+	flags = mosquitto_want_write(*l->mosq) ? ULOOP_READ | ULOOP_WRITE :
+	        ULOOP_READ;
+	if (!l->ufd.registered || l->ufd.flags != flags) {
+		uloop_fd_add(&l->ufd, flags);
+	}
+}
+
+static void mosq_ufd_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	int rc = MOSQ_ERR_SUCCESS;
+	struct mosq_link *l = container_of(ufd, struct mosq_link, ufd);
+
+	if (events & ULOOP_READ) {
+		rc = mosquitto_loop_read(*l->mosq, 1);
+	}
+	if (rc == MOSQ_ERR_SUCCESS && (events & ULOOP_WRITE)) {
+		rc = mosquitto_loop_write(*l->mosq, 1);
+	}
+	if (rc != MOSQ_ERR_SUCCESS) {
+		if (conf.verbosity > 0) {
+			fprintf(stdout, "[mosq] connection lost: %s\n",
+			        mosquitto_strerror(rc));
+		}
+		uloop_fd_delete(&l->ufd);
+		l->ufd.fd = -1;
+		return;
+	}
+	mosq_events(l);
+}
+
+static void mosq_timer_cb(struct uloop_timeout *t)
+{
+	struct mosq_link *l;
+
+	for (l = mosq_link; l < mosq_link + MOSQ_LINKS; l++) {
+		if (*l->mosq == NULL) {
+			continue;
+		}
+		if (l->ufd.fd < 0) {
+			mosquitto_reconnect_async(*l->mosq);
+		} else {
+			mosquitto_loop_misc(*l->mosq);
+		}
+		mosq_events(l);
+	}
+	uloop_timeout_set(t, CONFIG_MQTT_MISC_TIMEOUT);
+}
+
+static void mosq_flush_cb(struct uloop_timeout *t)
+{
+	struct mosq_link *l;
+
+	for (l = mosq_link; l < mosq_link + MOSQ_LINKS; l++) {
+		if (*l->mosq != NULL && l->ufd.fd >= 0) {
+			mosq_events(l);
+		}
+	}
+}
+
+/* one check per burst of publishes, not one per message */
+static void mosq_on_sent(void)
+{
+	if (!mosq_flush.pending) {
+		uloop_timeout_set(&mosq_flush, 0);
+	}
+}
+
+static void mosq_single_start(void)
+{
+	struct mosq_link *l;
+
+	for (l = mosq_link; l < mosq_link + MOSQ_LINKS; l++) {
+		l->ufd.cb = mosq_ufd_cb;
+	}
+	mosq_flush.cb = mosq_flush_cb;
+	pub_set_sent_cb(mosq_on_sent);
+	mosq_timer.cb = mosq_timer_cb;
+	mosq_timer_cb(&mosq_timer);
+}
+
+/* loop thread unless single-threaded, then the connection itself */
+static bool mosq_start(struct mosquitto *mosq, int *rc)
+{
+	if (!conf.single) {
+		*rc = mosquitto_loop_start(mosq);
+		switch (*rc) {
+		case MOSQ_ERR_INVAL:
+			fprintf(stderr, "mosq_loop_start: Invalid input parameters.\n");
+			return false;
+		case MOSQ_ERR_NOT_SUPPORTED:
+			fprintf(stderr, "mosq_loop_start: No threading support.\n");
+			return false;
+		};
+	}
+	*rc = mosquitto_connect_async(mosq, conf.mqtt.host, conf.mqtt.port,
+	                  conf.mqtt.keepalive);
+	switch (*rc) {
+	case MOSQ_ERR_INVAL:
+		fprintf(stderr, "mosq_connect_async: Invalid input parameters.\n");
+		return false;
+	case MOSQ_ERR_ERRNO:
+		perror("mosq_connect_async");
+		return false;
+	}
+	return true;
+}
+
+static long long mosq_now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+/*
+ * Without the loop thread mosquitto_disconnect() only queues the
+ * DISCONNECT, so write it out here, within CONFIG_MQTT_CLOSE_TIMEOUT, or
+ * the broker only sees the connection drop.
+ */
+static void mosq_drain(struct mosquitto *mosq)
+{
+	struct pollfd pfd = { .fd = mosquitto_socket(mosq), .events = POLLOUT };
+	long long left, deadline;
+
+	deadline = mosq_now_ms() + CONFIG_MQTT_CLOSE_TIMEOUT;
+	while (pfd.fd >= 0 && mosquitto_want_write(mosq)) {
+		left = deadline - mosq_now_ms();
+		if (left <= 0 || poll(&pfd, 1, left) <= 0 ||
+		    mosquitto_loop_write(mosq, 1) != MOSQ_ERR_SUCCESS) {
+			break;
+		}
+	}
+}
+
+static void mosq_stop(struct mosquitto *mosq)
+{
+	if (mosq == NULL) {
+		return;
+	}
+	mosquitto_disconnect(mosq);
+	if (conf.single) {
+		mosq_drain(mosq);
+	} else {
+		mosquitto_loop_stop(mosq, false);
+	}
+	mosquitto_destroy(mosq);
+}
+
 static void ub_sighup(struct ubus_context *ctx, struct ubus_event_handler *ev,
                    const char *type, struct blob_attr *msg)
 {
@@ -218,6 +421,107 @@ static void ub_kube_packet_tx(struct ubus_context *ctx, struct ubus_event_handle
 	}
 }
 
+enum {
+	UB_HISTORY_SENSOR,
+	UB_HISTORY_TYPE,
+	UB_HISTORY_START,
+	UB_HISTORY_END,
+	UB_HISTORY_STEP,
+	__UB_HISTORY_MAX
+};
+
+static const struct blobmsg_policy ub_history_policy[__UB_HISTORY_MAX] = {
+	[UB_HISTORY_SENSOR] = { .name = "sensor", .type = BLOBMSG_TYPE_STRING },
+	[UB_HISTORY_TYPE] = { .name = "type", .type = BLOBMSG_TYPE_STRING },
+	[UB_HISTORY_START] = { .name = "start", .type = BLOBMSG_TYPE_INT32 },
+	[UB_HISTORY_END] = { .name = "end", .type = BLOBMSG_TYPE_INT32 },
+	[UB_HISTORY_STEP] = { .name = "step", .type = BLOBMSG_TYPE_INT32 },
+};
+
+static struct blob_buf ub_buf;
+static struct history_point ub_history_point[HISTORY_POINTS_MAX];
+
+/*
+ * ubus call flx history '{"sensor":"<id>","type":"gauge","start":<t>,
+ * "end":<t>,"step":<s>}' replies with [time, value] pairs, values in
+ * 1/scale of the unit. type defaults to counter, end to now, start to an
+ * hour before end and step to the width of a history slot.
+ */
+static int ub_history(struct ubus_context *ctx, struct ubus_object *obj,
+                      struct ubus_request_data *req, const char *method,
+                      struct blob_attr *msg)
+{
+	int i, n, sensor = -1;
+	uint32_t start, end;
+	unsigned int step;
+	const char *id, *type, *unit = NULL;
+	enum history_kind kind = HISTORY_COUNTER;
+	struct blob_attr *tb[__UB_HISTORY_MAX];
+	void *values, *pair;
+
+	blobmsg_parse(ub_history_policy, __UB_HISTORY_MAX, tb, blob_data(msg),
+	              blob_len(msg));
+	if (!tb[UB_HISTORY_SENSOR]) {
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+	id = blobmsg_get_string(tb[UB_HISTORY_SENSOR]);
+	for (i = 0; i < CONFIG_MAX_SENSORS; i++) {
+		if (conf.sensor[i].enable && strcmp(conf.sensor[i].id, id) == 0) {
+			sensor = i;
+			break;
+		}
+	}
+	type = tb[UB_HISTORY_TYPE] ? blobmsg_get_string(tb[UB_HISTORY_TYPE]) :
+	                             "counter";
+	if (strcmp(type, "gauge") == 0) {
+		kind = HISTORY_GAUGE;
+	} else if (strcmp(type, "counter") != 0) {
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+	end = tb[UB_HISTORY_END] ? blobmsg_get_u32(tb[UB_HISTORY_END]) :
+	                           (uint32_t)time(NULL);
+	start = tb[UB_HISTORY_START] ? blobmsg_get_u32(tb[UB_HISTORY_START]) :
+	        end > HISTORY_SPAN_DEFAULT ? end - HISTORY_SPAN_DEFAULT : 0;
+	step = tb[UB_HISTORY_STEP] ? blobmsg_get_u32(tb[UB_HISTORY_STEP]) : 0;
+	n = history_query(sensor, kind, start, end, &step, &unit,
+	                  ub_history_point);
+	if (n < 0) {
+		return UBUS_STATUS_NOT_FOUND;
+	}
+
+	blob_buf_init(&ub_buf, 0);
+	blobmsg_add_string(&ub_buf, "sensor", id);
+	blobmsg_add_string(&ub_buf, "type", type);
+	if (unit != NULL) {
+		blobmsg_add_string(&ub_buf, "unit", unit);
+	}
+	blobmsg_add_u32(&ub_buf, "step", step);
+	blobmsg_add_u32(&ub_buf, "scale", 1000);
+	values = blobmsg_open_array(&ub_buf, "values");
+	for (i = 0; i < n; i++) {
+		pair = blobmsg_open_array(&ub_buf, NULL);
+		blobmsg_add_u32(&ub_buf, NULL, ub_history_point[i].time);
+		blobmsg_add_u64(&ub_buf, NULL, (uint64_t)ub_history_point[i].value);
+		blobmsg_close_array(&ub_buf, pair);
+	}
+	blobmsg_close_array(&ub_buf, values);
+	return ubus_send_reply(ctx, req, ub_buf.head);
+}
+
+static const struct ubus_method ub_flx_methods[] = {
+	UBUS_METHOD("history", ub_history, ub_history_policy),
+};
+
+static struct ubus_object_type ub_flx_type =
+	UBUS_OBJECT_TYPE(CONFIG_UBUS_OBJECT, ub_flx_methods);
+
+static struct ubus_object ub_flx = {
+	.name = CONFIG_UBUS_OBJECT,
+	.type = &ub_flx_type,
+	.methods = ub_flx_methods,
+	.n_methods = ARRAY_SIZE(ub_flx_methods),
+};
+
 struct config conf = {
 	.me = "flxd",
 	.verbosity = 0,
@@ -254,9 +558,33 @@ int main(int argc, char **argv)
 {
 	int opt, rc = 0;
 	struct sigaction sa;
-
-	while ((opt = getopt(argc, argv, "hv")) != -1) {
+	char *spec = NULL;
+	char spec_uci[CONFIG_STR_MAX];
+	char *capture = NULL;
+	unsigned int pace = CAPTURE_PACE_DEFAULT;
+	long latency = -1;
+	bool single = false;
+	char bulk_id[CONFIG_MQTT_ID_LEN];
+
+	conf.transport.fd = -1;
+	conf.transport.fd_hold = -1;
+	while ((opt = getopt(argc, argv, "d:hl:p:svw:")) != -1) {
 		switch (opt) {
+		case 'd':
+			spec = optarg;
+			break;
+		case 'l':
+			latency = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			pace = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			single = true;
+			break;
+		case 'w':
+			capture = optarg;
+			break;
 		case 'v':
 			conf.verbosity++;
 			break;
@@ -266,28 +594,48 @@ int main(int argc, char **argv)
 		}	
 	}
 
+	if (!config_init()) {
+		rc = 4;
+		goto oom;
+	}
+	if (spec == NULL) {
+		config_load_transport(spec_uci);
+		spec = spec_uci;
+	}
+	if (!transport_parse(&conf.transport, spec)) {
+		fprintf(stderr, "%s: Invalid transport\n", spec);
+		return usage(argv[0]);
+	}
+	if (latency < 0) {
+		latency = config_load_latency();
+	}
+	conf.flx_latency = latency > FLX_LATENCY_MAX ? FLX_LATENCY_MAX : latency;
+	conf.single = single || config_load_single();
+	conf.split = config_load_split();
+
 	conf.fd_globe = open(CONFIG_GLOBE_LED_PATH, O_WRONLY);
 	if (conf.fd_globe < 0) {
 		perror(CONFIG_GLOBE_LED_PATH);
-		rc = 1;
-		goto finish;
+		/* only the meter's own sensor board comes with a globe led */
+		if (strcmp(conf.transport.path, FLX_DEV) == 0) {
+			rc = 1;
+			goto finish;
+		}
 	}
-	conf.flx_ufd.fd = open(FLX_DEV, O_RDWR);
+	conf.flx_ufd.fd = transport_open(&conf.transport);
 	if (conf.flx_ufd.fd < 0) {
-		perror(FLX_DEV);
 		rc = 2;
 		goto finish;
 	}
-	if (!configure_tty(conf.flx_ufd.fd)) {
-		fprintf(stderr, "%s: Failed to configure tty params\n", FLX_DEV);
+	if (capture != NULL && !capture_open(capture)) {
 		rc = 3;
 		goto finish;
 	}
-
-	if (!config_init()) {
-		rc = 4;
-		goto oom;
+	if (flx_init() < 0) {
+		rc = 11;
+		goto finish;
 	}
+
 	if (!config_load_all()) {
 		rc = 5;
 		goto finish;
@@ -310,7 +658,15 @@ int main(int argc, char **argv)
 #endif
 
 	mosquitto_lib_init();
-	snprintf(conf.mqtt.id, CONFIG_MQTT_ID_LEN, CONFIG_MQTT_ID_TPL, getpid());
+	if (conf.split) {
+		/* a persistent session needs an id that survives a restart */
+		snprintf(conf.mqtt.id, CONFIG_MQTT_ID_LEN, CONFIG_MQTT_ID_DATA_TPL,
+		         conf.device);
+		conf.mqtt.clean_session = false;
+		conf.mqtt.qos = CONFIG_MQTT_DATA_QOS;
+	} else {
+		snprintf(conf.mqtt.id, CONFIG_MQTT_ID_LEN, CONFIG_MQTT_ID_TPL, getpid());
+	}
 	snprintf(conf.topic_bridge_stat, CONFIG_STR_MAX, CONFIG_TOPIC_BRIDGE_STAT,
 	         conf.device);
 #ifdef WITH_YKW
@@ -330,30 +686,56 @@ int main(int argc, char **argv)
 		}
 	}
 	mosquitto_connect_callback_set(conf.mosq, mosq_on_connect_cb);
+	mosquitto_disconnect_callback_set(conf.mosq, mosq_on_disconnect_cb);
 	mosquitto_message_callback_set(conf.mosq, mosq_on_message_cb);
-	rc = mosquitto_loop_start(conf.mosq);
-	switch (rc) {
-	case MOSQ_ERR_INVAL:
-		fprintf(stderr, "mosq_loop_start: Invalid input parameters.\n");
-		goto finish;
-	case MOSQ_ERR_NOT_SUPPORTED:
-		fprintf(stderr, "mosq_loop_start: No threading support.\n");
-		goto finish;
-	};
-	rc = mosquitto_connect_async(conf.mosq, conf.mqtt.host, conf.mqtt.port,
-	                  conf.mqtt.keepalive);
-	switch (rc) {
-	case MOSQ_ERR_INVAL:
-		fprintf(stderr, "mosq_connect_async: Invalid input parameters.\n");
+	mosquitto_publish_callback_set(conf.mosq, mosq_on_publish_cb);
+#ifdef WITH_MQTT5
+	mosquitto_int_option(conf.mosq, MOSQ_OPT_PROTOCOL_VERSION,
+	                     MQTT_PROTOCOL_V5);
+	mosquitto_connect_v5_callback_set(conf.mosq, pub_on_connect_v5);
+#endif
+	if (conf.mqtt.inflight > 0) {
+		mosquitto_max_inflight_messages_set(conf.mosq, conf.mqtt.inflight);
+	}
+	if (!mosq_start(conf.mosq, &rc)) {
 		goto finish;
-	case MOSQ_ERR_ERRNO:
-		perror("mosq_connect_async");
+	}
+	if (conf.split) {
+		snprintf(bulk_id, CONFIG_MQTT_ID_LEN, CONFIG_MQTT_ID_BULK_TPL,
+		         getpid());
+		conf.mosq_bulk = mosquitto_new(bulk_id, true, &conf);
+		if (!conf.mosq_bulk) {
+			rc = 8;
+			goto oom;
+		}
+		mosquitto_publish_callback_set(conf.mosq_bulk, pub_on_publish);
+		mosquitto_connect_callback_set(conf.mosq_bulk, mosq_bulk_on_link_cb);
+		mosquitto_disconnect_callback_set(conf.mosq_bulk,
+		                                  mosq_bulk_on_link_cb);
+		if (!mosq_start(conf.mosq_bulk, &rc)) {
+			goto finish;
+		}
+	}
+	if (!conf.single && !pub_start()) {
+		rc = 12;
 		goto finish;
 	}
 
 	uloop_init();
-	uloop_fd_add(&conf.flx_ufd, ULOOP_READ);
+	if (conf.transport.type == TRANSPORT_REPLAY) {
+		if (!capture_replay_start(conf.flx_ufd.fd, pace)) {
+			rc = 3;
+			goto finish;
+		}
+	} else if (!flx_rx_start(&conf.flx_ufd)) {
+		rc = 13;
+		goto finish;
+	}
 	uloop_timeout_set(&conf.timeout, CONFIG_ULOOP_TIMEOUT);
+	if (conf.single) {
+		mosq_single_start();
+	}
+	stream_start();
 	ubus_add_uloop(conf.ubus_ctx);
 	ubus_register_event_handler(conf.ubus_ctx, &conf.ubus_ev_sighup,
 	                            CONFIG_UBUS_EV_SIGHUP);
@@ -363,6 +745,10 @@ int main(int argc, char **argv)
 	                            CONFIG_UBUS_EV_KUBE_CTRL);
 	ubus_register_event_handler(conf.ubus_ctx, &conf.ubus_ev_kube_packet_tx,
 	                            CONFIG_UBUS_EV_KUBE_PKT_TX);
+	if (ubus_add_object(conf.ubus_ctx, &ub_flx) != 0) {
+		fprintf(stderr, "Failed to add the %s ubus object\n",
+		        CONFIG_UBUS_OBJECT);
+	}
 
 	sigemptyset(&sa.sa_mask);
 	sa.sa_flags = 0;
@@ -373,16 +759,29 @@ int main(int argc, char **argv)
 		goto finish;
 	}
 
+	flx_stats_init();
 	uloop_run();
+	bundle_flush();
 	uloop_done();
+	if (conf.verbosity > 0) {
+		flx_stats_print(stdout);
+		pub_stats_print(stdout);
+		spool_stats_print(stdout);
+		history_stats_print(stdout);
+		stream_stats_print(stdout);
+	}
 	goto finish;
 
 oom:
 	fprintf(stderr, "error: Out of memory.\n");
 finish:
-	mosquitto_disconnect(conf.mosq);
-	mosquitto_loop_stop(conf.mosq, false);
-	mosquitto_destroy(conf.mosq);
+	stream_stop();
+	latest_close();
+	history_close();
+	spool_close();
+	pub_stop();
+	mosq_stop(conf.mosq_bulk);
+	mosq_stop(conf.mosq);
 	mosquitto_lib_cleanup();
 #ifdef WITH_YKW
 	ykw_free(conf.ykw);
@@ -390,8 +789,12 @@ finish:
 	if (conf.ubus_ctx != NULL) {
 		ubus_free(conf.ubus_ctx);
 	}
-	flx_tx(FLX_TYPE_EXIT, NULL, 0);
-	close(conf.flx_ufd.fd);
+	if (conf.transport.fd >= 0) {
+		flx_tx(FLX_TYPE_EXIT, NULL, 0);
+	}
+	capture_replay_stop();
+	capture_close();
+	transport_close(&conf.transport);
 	uci_free_context(conf.uci_ctx);
 	return rc;
 }
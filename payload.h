@@ -0,0 +1,111 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdint.h>
+
+/*
+ * Telegram payloads as sent by the sensor board. Multi-byte fields are
+ * little-endian on the wire.
+ */
+#define DECODE_NUM_SAMPLES 32
+#define DECODE_KUBE_MAX_PACKET_SIZE (64 + 5)
+
+enum decode_ct_params {
+	DECODE_CT_PARAM_PPLUS,
+	DECODE_CT_PARAM_PMINUS,
+	DECODE_CT_PARAM_Q1,
+	DECODE_CT_PARAM_Q2,
+	DECODE_CT_PARAM_Q3,
+	DECODE_CT_PARAM_Q4,
+	DECODE_CT_PARAM_VRMS,
+	DECODE_CT_PARAM_IRMS,
+	DECODE_CT_PARAM_PF,
+	DECODE_CT_PARAM_VTHD,
+	DECODE_CT_PARAM_ITHD,
+	DECODE_CT_PARAM_ALPHA,
+	DECODE_MAX_CT_PARAMS
+};
+
+struct ct_data_s {
+	uint32_t time;
+	uint16_t millis;
+	uint8_t port;
+	uint8_t padding;
+	uint32_t counter_integ[DECODE_CT_PARAM_Q4 + 1];
+	uint16_t counter_frac[DECODE_CT_PARAM_Q4 + 1];
+	int32_t gauge[DECODE_MAX_CT_PARAMS];
+};
+
+struct pulse_data_s {
+	uint32_t time;
+	uint16_t millis;
+	uint8_t port;
+	uint8_t padding;
+	int32_t gauge; /* q20.11 */
+	uint32_t counter_integ;
+	uint16_t counter_millis;
+};
+
+struct kube_packet_s {
+	uint32_t time;
+	uint16_t millis;
+	uint8_t rssi;
+	uint8_t packet[DECODE_KUBE_MAX_PACKET_SIZE];
+};
+
+struct sar_s {
+	uint32_t time;
+	uint16_t millis;
+	uint16_t adc[DECODE_NUM_SAMPLES];
+};
+
+struct sdadc_s {
+	uint32_t time;
+	uint16_t millis;
+	uint8_t index;
+	uint8_t padding;
+	int16_t adc[DECODE_NUM_SAMPLES];
+};
+
+struct voltage_s {
+	uint32_t time;
+	uint16_t millis;
+	uint16_t padding;
+	int32_t rms;
+	int32_t sample[DECODE_NUM_SAMPLES];
+};
+
+struct current_s {
+	uint32_t time;
+	uint16_t millis;
+	uint8_t index;
+	uint8_t padding;
+	int32_t rms;
+	int32_t sample[DECODE_NUM_SAMPLES];
+};
+
+#endif
@@ -0,0 +1,461 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <mosquitto.h>
+#include "config.h"
+#include "pub.h"
+
+struct pub_slot {
+	int len;
+	int qos;
+	bool retain;
+	bool spill; /* the payload is in the ring's spill buffer */
+	uint16_t alias;
+	char topic[PUB_TOPIC_MAX];
+	unsigned char payload[PUB_PAYLOAD_MAX];
+};
+
+/*
+ * One ring per traffic class. head is only written by the uloop thread,
+ * tail only by the publisher. space counts the free slots so a full ring
+ * holds up decoding instead of losing readings. A payload too big for a
+ * slot, such as a bundle, borrows the spill buffer until it is sent.
+ */
+struct pub_ring {
+	size_t size; /* power of two */
+	size_t head;
+	size_t tail;
+	size_t high;
+	unsigned long long queued;
+	unsigned long long direct;
+	unsigned long long full;
+	unsigned long long shed;
+	unsigned long long spilled;
+	int spill_busy;
+	sem_t space;
+	struct pub_slot *slot;
+	unsigned char *spill;
+};
+
+static struct pub_slot pub_slot_data[PUB_QUEUE_SIZE];
+static struct pub_slot pub_slot_gauge[PUB_QUEUE_SIZE_GAUGE];
+static struct pub_slot pub_slot_bulk[PUB_QUEUE_SIZE_BULK];
+static unsigned char pub_spill[PUB_CLASSES][PUB_SPILL_MAX];
+
+/*
+ * items counts the filled slots of all rings so the publisher sleeps when
+ * idle. pending counts, per connection, the messages libmosquitto
+ * accepted and has not yet reported as sent (QoS 0) or acknowledged. sent
+ * is called after every publish handed to libmosquitto.
+ */
+static struct {
+	bool running;
+	void (*sent)(void);
+	unsigned int budget;
+	int pending[PUB_LINKS];
+	int pending_high;
+	sem_t items;
+	pthread_t thread;
+	struct pub_ring ring[PUB_CLASSES];
+} pub = {
+	.ring = {
+		[PUB_CLASS_DATA] = {
+			.size = PUB_QUEUE_SIZE,
+			.slot = pub_slot_data,
+			.spill = pub_spill[PUB_CLASS_DATA]
+		},
+		[PUB_CLASS_GAUGE] = {
+			.size = PUB_QUEUE_SIZE_GAUGE,
+			.slot = pub_slot_gauge,
+			.spill = pub_spill[PUB_CLASS_GAUGE]
+		},
+		[PUB_CLASS_BULK] = {
+			.size = PUB_QUEUE_SIZE_BULK,
+			.slot = pub_slot_bulk,
+			.spill = pub_spill[PUB_CLASS_BULK]
+		}
+	}
+};
+
+#ifdef WITH_MQTT5
+/*
+ * Topic aliases of the main connection, only touched by whoever publishes
+ * (the publisher thread, or the uloop thread when there is none). The
+ * connect callback announces a new session through generation, after
+ * which every alias has to be established again.
+ */
+static struct {
+	int generation;
+	int seen;
+	uint16_t max; /* from the broker's CONNACK */
+	unsigned long long hits;
+	mosquitto_property *prop[PUB_ALIAS_MAX + 1];
+	char topic[PUB_ALIAS_MAX + 1][PUB_TOPIC_MAX];
+} pub_alias;
+#endif
+
+static const char *pub_class_name[PUB_CLASSES] = {
+	"data",
+	"gauge",
+	"bulk"
+};
+
+/* bulk traffic goes out best effort on its own connection, if there is one */
+/* the count of the connection, conf.mosq_bulk or else the main one */
+static int *pub_pending(struct mosquitto *mosq)
+{
+	return &pub.pending[mosq != NULL && mosq == conf.mosq_bulk ?
+	                    PUB_LINK_BULK : PUB_LINK_MAIN];
+}
+
+static unsigned int pub_pending_total(void)
+{
+	int i;
+	unsigned int total = 0;
+
+	for (i = 0; i < PUB_LINKS; i++) {
+		total += __atomic_load_n(&pub.pending[i], __ATOMIC_RELAXED);
+	}
+	return total;
+}
+
+static struct mosquitto *pub_client(enum pub_class cls, int *qos)
+{
+	if (cls == PUB_CLASS_BULK && conf.mosq_bulk != NULL) {
+		*qos = 0;
+		return conf.mosq_bulk;
+	}
+	return conf.mosq;
+}
+
+#ifdef WITH_MQTT5
+void pub_on_connect_v5(struct mosquitto *mosq, void *obj, int rc, int flags,
+                       const mosquitto_property *props)
+{
+	uint16_t max = 0;
+
+	if (rc != 0) {
+		return;
+	}
+	mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &max,
+	                              false);
+	__atomic_store_n(&pub_alias.max, max, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pub_alias.generation, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The first publish of an alias in a session, or after its topic changed
+ * with a new publish plan, carries both. Later ones only the alias. QoS > 0
+ * messages could be resent on a later session where the alias means
+ * nothing, so they always carry the topic.
+ */
+static int pub_send_alias(struct mosquitto *mosq, int *mid, uint16_t alias,
+                          const char *topic, int len, const void *payload,
+                          int qos, bool retain)
+{
+	int rc, generation;
+
+	if (alias == 0 || alias > PUB_ALIAS_MAX || mosq != conf.mosq) {
+		return mosquitto_publish(mosq, mid, topic, len, payload, qos, retain);
+	}
+	generation = __atomic_load_n(&pub_alias.generation, __ATOMIC_ACQUIRE);
+	if (generation != pub_alias.seen) {
+		memset(pub_alias.topic, 0, sizeof(pub_alias.topic));
+		pub_alias.seen = generation;
+	}
+	if (qos > 0 || alias > __atomic_load_n(&pub_alias.max, __ATOMIC_RELAXED) ||
+	    (pub_alias.prop[alias] == NULL &&
+	     mosquitto_property_add_int16(&pub_alias.prop[alias],
+	                                  MQTT_PROP_TOPIC_ALIAS, alias) !=
+	     MOSQ_ERR_SUCCESS)) {
+		return mosquitto_publish(mosq, mid, topic, len, payload, qos, retain);
+	}
+	if (strcmp(pub_alias.topic[alias], topic) == 0) {
+		pub_alias.hits++;
+		return mosquitto_publish_v5(mosq, mid, NULL, len, payload, qos,
+		                            retain, pub_alias.prop[alias]);
+	}
+	rc = mosquitto_publish_v5(mosq, mid, topic, len, payload, qos, retain,
+	                          pub_alias.prop[alias]);
+	if (rc == MOSQ_ERR_SUCCESS) {
+		strcpy(pub_alias.topic[alias], topic);
+	}
+	return rc;
+}
+
+static void pub_alias_free(void)
+{
+	int i;
+
+	for (i = 0; i <= PUB_ALIAS_MAX; i++) {
+		mosquitto_property_free_all(&pub_alias.prop[i]);
+	}
+}
+#else
+static int pub_send_alias(struct mosquitto *mosq, int *mid, uint16_t alias,
+                          const char *topic, int len, const void *payload,
+                          int qos, bool retain)
+{
+	return mosquitto_publish(mosq, mid, topic, len, payload, qos, retain);
+}
+#endif
+
+static int pub_send(enum pub_class cls, int *mid, uint16_t alias,
+                    const char *topic, int len, const void *payload, int qos,
+                    bool retain)
+{
+	struct mosquitto *mosq = pub_client(cls, &qos);
+	int rc;
+	unsigned int pending;
+
+	/*
+	 * Counted before the call: a QoS 0 message can be written out and
+	 * reported by on_publish before mosquitto_publish() even returns.
+	 */
+	__atomic_add_fetch(pub_pending(mosq), 1, __ATOMIC_RELAXED);
+	pending = pub_pending_total();
+	if ((int)pending > __atomic_load_n(&pub.pending_high, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&pub.pending_high, pending, __ATOMIC_RELAXED);
+	}
+	rc = pub_send_alias(mosq, mid, alias, topic, len, payload, qos, retain);
+	if (rc != MOSQ_ERR_SUCCESS) {
+		pub_on_publish(mosq, NULL, 0);
+	} else if (pub.sent != NULL) {
+		pub.sent();
+	}
+	return rc;
+}
+
+void pub_on_publish(struct mosquitto *mosq, void *obj, int mid)
+{
+	int *count = pub_pending(mosq);
+	int pending = __atomic_load_n(count, __ATOMIC_RELAXED);
+
+	/* never below zero, messages queued before pub_configure() count too */
+	while (pending > 0 &&
+	       !__atomic_compare_exchange_n(count, &pending, pending - 1, true,
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * A lost connection drops the queued QoS 0 messages without an on_publish
+ * for them, and QoS > 0 ones are reported again once resent. Either way
+ * nothing counted so far on that connection is still owed a callback.
+ */
+void pub_forget_pending(struct mosquitto *mosq)
+{
+	__atomic_store_n(pub_pending(mosq), 0, __ATOMIC_RELAXED);
+}
+
+/* everything accepted but not yet on the wire */
+static unsigned int pub_backlog(void)
+{
+	int cls;
+	unsigned int backlog = pub_pending_total();
+	struct pub_ring *r;
+
+	for (cls = 0; cls < PUB_CLASSES; cls++) {
+		r = &pub.ring[cls];
+		backlog += r->head - __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	}
+	return backlog;
+}
+
+void pub_configure(unsigned int budget)
+{
+	pub.budget = budget;
+}
+
+/* single-threaded mode, where whoever drives the sockets must know */
+void pub_set_sent_cb(void (*cb)(void))
+{
+	pub.sent = cb;
+}
+
+static void *pub_thread(void *arg)
+{
+	int cls;
+	struct pub_ring *r;
+	struct pub_slot *s;
+
+	for (;;) {
+		if (sem_wait(&pub.items) < 0) {
+			continue; /* EINTR */
+		}
+		/* in class order, data never waits behind a burst of bulk */
+		for (cls = 0; cls < PUB_CLASSES; cls++) {
+			r = &pub.ring[cls];
+			if (r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+		}
+		if (cls == PUB_CLASSES) {
+			break; /* woken up by pub_stop() with nothing left */
+		}
+		s = &r->slot[r->tail & (r->size - 1)];
+		pub_send(cls, NULL, s->alias, s->topic, s->len,
+		         s->spill ? r->spill : s->payload, s->qos, s->retain);
+		if (s->spill) {
+			__atomic_store_n(&r->spill_busy, 0, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+		sem_post(&r->space);
+	}
+	return NULL;
+}
+
+static void pub_destroy(void)
+{
+	int cls;
+
+	sem_destroy(&pub.items);
+	for (cls = 0; cls < PUB_CLASSES; cls++) {
+		sem_destroy(&pub.ring[cls].space);
+	}
+}
+
+bool pub_start(void)
+{
+	int cls;
+
+	if (pub.running) {
+		return true;
+	}
+	if (sem_init(&pub.items, 0, 0) < 0) {
+		perror("sem_init");
+		return false;
+	}
+	for (cls = 0; cls < PUB_CLASSES; cls++) {
+		pub.ring[cls].head = pub.ring[cls].tail = 0;
+		sem_init(&pub.ring[cls].space, 0, pub.ring[cls].size);
+	}
+	errno = pthread_create(&pub.thread, NULL, pub_thread, NULL);
+	if (errno != 0) {
+		perror("pthread_create");
+		pub_destroy();
+		return false;
+	}
+	pub.running = true;
+	return true;
+}
+
+/* publishes whatever is still queued, then joins the publisher thread */
+void pub_stop(void)
+{
+	if (pub.running) {
+		pub.running = false;
+		sem_post(&pub.items);
+		pthread_join(pub.thread, NULL);
+		pub_destroy();
+	}
+#ifdef WITH_MQTT5
+	pub_alias_free();
+#endif
+}
+
+bool pub_publish_alias(enum pub_class cls, uint16_t alias, const char *topic,
+                       int len, const void *payload, int qos, bool retain)
+{
+	struct pub_ring *r = &pub.ring[cls];
+	struct pub_slot *s;
+	size_t fill, topic_len = strlen(topic);
+	bool spill = len > PUB_PAYLOAD_MAX;
+
+	if (cls != PUB_CLASS_DATA && pub.budget > 0 &&
+	    pub_backlog() >= pub.budget) {
+		r->shed++;
+		return false;
+	}
+	if (!pub.running || topic_len >= PUB_TOPIC_MAX ||
+	    (spill && (len > PUB_SPILL_MAX ||
+	               __atomic_load_n(&r->spill_busy, __ATOMIC_ACQUIRE)))) {
+		r->direct++;
+		return pub_send(cls, NULL, alias, topic, len, payload, qos, retain) ==
+		       MOSQ_ERR_SUCCESS;
+	}
+	if (sem_trywait(&r->space) < 0) {
+		r->full++;
+		while (sem_wait(&r->space) < 0 && errno == EINTR);
+	}
+	fill = r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	s = &r->slot[r->head & (r->size - 1)];
+	memcpy(s->topic, topic, topic_len + 1);
+	if (spill) {
+		__atomic_store_n(&r->spill_busy, 1, __ATOMIC_RELAXED);
+		memcpy(r->spill, payload, len);
+		r->spilled++;
+	} else {
+		memcpy(s->payload, payload, len);
+	}
+	s->spill = spill;
+	s->len = len;
+	s->qos = qos;
+	s->retain = retain;
+	s->alias = alias;
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+	sem_post(&pub.items);
+	r->queued++;
+	r->high = fill + 1 > r->high ? fill + 1 : r->high;
+	return true;
+}
+
+/*
+ * Straight to the data connection, bypassing the rings, for a caller that
+ * tracks delivery itself. mosquitto stores the mid before the message can
+ * be sent, so an on_publish can always be matched against it.
+ */
+bool pub_publish_mid(const char *topic, int len, const void *payload, int qos,
+                     bool retain, int *mid)
+{
+	return pub_send(PUB_CLASS_DATA, mid, 0, topic, len, payload, qos,
+	                retain) == MOSQ_ERR_SUCCESS;
+}
+
+void pub_stats_print(FILE *stream)
+{
+	int cls;
+	struct pub_ring *r;
+
+	for (cls = 0; cls < PUB_CLASSES; cls++) {
+		r = &pub.ring[cls];
+		fprintf(stream,
+		    "[pub] %s: %llu queued (%zu max in queue), %llu spilled, "
+		    "%llu direct, %llu waits on a full queue, %llu shed\n",
+		    pub_class_name[cls], r->queued, r->high, r->spilled, r->direct,
+		    r->full, r->shed);
+	}
+	fprintf(stream, "[pub] %u pending in mosquitto (%d max), budget %u\n",
+	        pub_pending_total(),
+	        __atomic_load_n(&pub.pending_high, __ATOMIC_RELAXED), pub.budget);
+#ifdef WITH_MQTT5
+	fprintf(stream, "[pub] %llu publishes by topic alias (max %u)\n",
+	        pub_alias.hits, pub_alias.max);
+#endif
+}
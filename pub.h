@@ -0,0 +1,98 @@
+#ifndef PUB_H
+#define PUB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <mosquitto.h>
+
+/*
+ * Publishes are copied into a preallocated single-producer/single-consumer
+ * ring and handed to mosquitto by a publisher thread, so the uloop thread
+ * never takes libmosquitto's locks or allocates while decoding. Only a full
+ * queue makes pub_publish() wait for the publisher. A message over
+ * PUB_PAYLOAD_MAX goes through the ring's spill buffer. Until the thread
+ * runs, and for a message that finds the spill buffer taken or does not
+ * fit it either, pub_publish() falls back to publishing directly.
+ */
+#define PUB_QUEUE_SIZE			128 /* data slots, power of two */
+#define PUB_QUEUE_SIZE_GAUGE	64 /* gauge slots, power of two */
+#define PUB_QUEUE_SIZE_BULK		32 /* bulk slots, power of two */
+#define PUB_TOPIC_MAX			96
+#define PUB_PAYLOAD_MAX			1024
+#define PUB_SPILL_MAX			8192 /* per ring, fits a bundle */
+#define PUB_ALIAS_MAX			128 /* >= every slot of the decode plan */
+
+/*
+ * Traffic classes, each with its own ring and served in this order. Data
+ * is counters and anything else that must not be lost. Bulk is the
+ * waveform debug streams. With flx.main.split they also get their own
+ * best-effort connection, conf.mosq_bulk, so a burst of them never sits in
+ * front of the sensor readings.
+ *
+ * Once flx.main.budget messages are waiting, in the rings or inside
+ * libmosquitto, gauges and bulk are shed until the backlog drains. Data is
+ * never shed.
+ */
+enum pub_class {
+	PUB_CLASS_DATA,
+	PUB_CLASS_GAUGE,
+	PUB_CLASS_BULK,
+	PUB_CLASSES
+};
+
+/* connections with their own count of messages inside libmosquitto */
+enum pub_link {
+	PUB_LINK_MAIN,
+	PUB_LINK_BULK,
+	PUB_LINKS
+};
+
+void pub_configure(unsigned int budget);
+void pub_set_sent_cb(void (*cb)(void));
+bool pub_start(void);
+void pub_stop(void);
+void pub_on_publish(struct mosquitto *mosq, void *obj, int mid);
+void pub_forget_pending(struct mosquitto *mosq);
+#ifdef WITH_MQTT5
+void pub_on_connect_v5(struct mosquitto *mosq, void *obj, int rc, int flags,
+                       const mosquitto_property *props);
+#endif
+bool pub_publish_alias(enum pub_class cls, uint16_t alias, const char *topic,
+                       int len, const void *payload, int qos, bool retain);
+bool pub_publish_mid(const char *topic, int len, const void *payload, int qos,
+                     bool retain, int *mid);
+void pub_stats_print(FILE *stream);
+
+/*
+ * alias is a stable 1 .. PUB_ALIAS_MAX number for a topic that is
+ * published over and over, or 0. With WITH_MQTT5 and a broker that allows
+ * it, QoS 0 publishes on the main connection then carry an MQTT v5 topic
+ * alias instead of the topic once the alias is established.
+ */
+static inline bool pub_publish_class(enum pub_class cls, const char *topic,
+                                     int len, const void *payload, int qos,
+                                     bool retain)
+{
+	return pub_publish_alias(cls, 0, topic, len, payload, qos, retain);
+}
+
+static inline bool pub_publish(const char *topic, int len, const void *payload,
+                               int qos, bool retain)
+{
+	return pub_publish_class(PUB_CLASS_DATA, topic, len, payload, qos, retain);
+}
+
+static inline bool pub_publish_gauge(const char *topic, int len,
+                                     const void *payload, int qos, bool retain)
+{
+	return pub_publish_class(PUB_CLASS_GAUGE, topic, len, payload, qos, retain);
+}
+
+static inline bool pub_publish_bulk(const char *topic, int len,
+                                    const void *payload, int qos, bool retain)
+{
+	return pub_publish_class(PUB_CLASS_BULK, topic, len, payload, qos, retain);
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <sys/time.h>
 #include "config.h"
+#include "pub.h"
 #include "shift.h"
 
 const uint8_t map_shift_1p[] = { 0, 0, 3, 3, 3, 0 };
@@ -90,8 +91,7 @@ static void shift_pub(void)
 	snprintf(topic, CONFIG_STR_MAX, SHIFT_TOPIC, conf.device);
 	len = snprintf(data, CONFIG_STR_MAX, SHIFT_DATA_TPL, (int)t.tv_sec,
 	               conf.port[0].shift, conf.port[1].shift, conf.port[2].shift);
-	mosquitto_publish(conf.mosq, NULL, topic, len, data, conf.mqtt.qos,
-	                  conf.mqtt.retain);
+	pub_publish(topic, len, data, conf.mqtt.qos, conf.mqtt.retain);
 }
 
 static int32_t shift_calculate_shift(int32_t a)
@@ -0,0 +1,442 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libubox/uloop.h>
+#include "config.h"
+#include "pub.h"
+#include "spool.h"
+
+#define SPOOL_WRAP 0xffff /* topic_len of the record that sends us to 0 */
+#define SPOOL_ALIGN(n) (((n) + 3) & ~3U)
+
+/*
+ * File layout: this header, then size bytes of records. head, tail and
+ * used are byte offsets into the record area. Any offset from the tail
+ * maps to (tail + offset) % size, the bytes skipped by a wrap included.
+ */
+struct spool_file {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t used;
+	uint32_t reserved[3];
+};
+
+/* followed by the NUL terminated topic and the payload, 4 byte aligned */
+struct spool_rec {
+	uint16_t topic_len;
+	uint16_t len;
+};
+
+static struct {
+	int fd;
+	struct spool_file file;
+	unsigned char *data;
+	/* bytes appended since the last sync, from sync_from on */
+	uint32_t sync_from;
+	uint32_t unsynced;
+	bool dirty; /* the header changed since the last sync */
+	time_t synced;
+	int links_down; /* bit per enum spool_link, written by mosquitto */
+	int epoch; /* bumped by every link loss */
+	/* the batch being replayed, from the tail on */
+	uint32_t sent; /* bytes of it */
+	int inflight;
+	int acked;
+	int inflight_epoch;
+	time_t inflight_since;
+	int mid[SPOOL_REPLAY_BATCH]; /* 0 once acknowledged */
+	unsigned long long spooled;
+	unsigned long long replayed;
+	unsigned long long resent;
+	unsigned long long dropped;
+	struct uloop_timeout timer;
+} spool = {
+	.fd = -1,
+	.links_down = 1 << SPOOL_LINK_BROKER
+};
+
+static bool spool_online(void)
+{
+	return __atomic_load_n(&spool.links_down, __ATOMIC_SEQ_CST) == 0;
+}
+
+void spool_set_link(enum spool_link link, bool up)
+{
+	if (up) {
+		__atomic_and_fetch(&spool.links_down, ~(1 << link), __ATOMIC_SEQ_CST);
+	} else {
+		__atomic_or_fetch(&spool.links_down, 1 << link, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&spool.epoch, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/* from the mosquitto thread, for every message of the data connection */
+void spool_on_publish(int mid)
+{
+	int i, expected;
+
+	for (i = 0; i < SPOOL_REPLAY_BATCH; i++) {
+		expected = mid;
+		if (mid != 0 &&
+		    __atomic_compare_exchange_n(&spool.mid[i], &expected, 0, false,
+		                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			__atomic_add_fetch(&spool.acked, 1, __ATOMIC_SEQ_CST);
+			return;
+		}
+	}
+}
+
+static bool spool_valid(const struct spool_file *f, uint32_t size)
+{
+	return f->magic == SPOOL_MAGIC && f->size == size && f->head < size &&
+	       f->tail < size && f->used <= size && f->head % 4 == 0 &&
+	       f->tail % 4 == 0;
+}
+
+static void spool_reset(void)
+{
+	spool.file.head = spool.file.tail = spool.file.used = 0;
+	spool.sync_from = spool.unsynced = 0;
+	spool.sent = 0;
+	spool.dirty = true;
+}
+
+/*
+ * The record at offset *at from the tail, stepping *at over a wrap. NULL
+ * past the last one, or when the ring turns out corrupt.
+ */
+static struct spool_rec *spool_at(uint32_t *at)
+{
+	struct spool_file *f = &spool.file;
+	struct spool_rec *r;
+	uint32_t pos, room;
+
+	while (*at < f->used) {
+		pos = (f->tail + *at) % f->size;
+		room = f->size - pos;
+		r = (struct spool_rec *)(spool.data + pos);
+		if (room < sizeof(*r) || r->topic_len == SPOOL_WRAP) {
+			*at += room;
+			continue;
+		}
+		if (r->topic_len == 0 ||
+		    SPOOL_ALIGN(sizeof(*r) + r->topic_len + r->len) > room ||
+		    spool.data[pos + sizeof(*r) + r->topic_len - 1] != '\0') {
+			fprintf(stderr, "[spool] corrupt record, discarding spool\n");
+			spool_reset();
+			return NULL;
+		}
+		return r;
+	}
+	return NULL;
+}
+
+static uint32_t spool_rec_size(const struct spool_rec *r)
+{
+	return SPOOL_ALIGN(sizeof(*r) + r->topic_len + r->len);
+}
+
+/* drop bytes from the tail, which have to end on a record */
+static void spool_advance(uint32_t bytes)
+{
+	struct spool_file *f = &spool.file;
+
+	f->tail = (f->tail + bytes) % f->size;
+	f->used -= bytes;
+	spool.sent = spool.sent > bytes ? spool.sent - bytes : 0;
+	if (f->used == 0) {
+		spool_reset();
+	}
+	spool.dirty = true;
+}
+
+static void spool_drop_oldest(void)
+{
+	uint32_t at = 0;
+	struct spool_rec *r = spool_at(&at);
+
+	if (r != NULL) {
+		spool_advance(at + spool_rec_size(r));
+		spool.dropped++;
+	}
+}
+
+static bool spool_pwrite(const void *buf, size_t len, off_t offset)
+{
+	if (pwrite(spool.fd, buf, len, offset) != (ssize_t)len) {
+		perror("[spool] pwrite");
+		return false;
+	}
+	return true;
+}
+
+/* the appended bytes first, so the header never points past the data */
+static void spool_sync(bool force)
+{
+	uint32_t pos, chunk, left;
+	time_t now = time(NULL);
+
+	if (!(spool.dirty || spool.unsynced > 0) ||
+	    (!force && now - spool.synced < SPOOL_SYNC_INTERVAL)) {
+		return;
+	}
+	spool.synced = now;
+	if (spool.unsynced > 0) {
+		pos = spool.unsynced >= spool.file.size ? 0 : spool.sync_from;
+		left = spool.unsynced >= spool.file.size ? spool.file.size :
+		       spool.unsynced;
+		while (left > 0) {
+			chunk = spool.file.size - pos < left ? spool.file.size - pos :
+			        left;
+			if (!spool_pwrite(spool.data + pos, chunk,
+			                  sizeof(spool.file) + pos)) {
+				return;
+			}
+			pos = (pos + chunk) % spool.file.size;
+			left -= chunk;
+		}
+		fdatasync(spool.fd);
+		spool.sync_from = spool.file.head;
+		spool.unsynced = 0;
+	}
+	if (spool_pwrite(&spool.file, sizeof(spool.file), 0)) {
+		fdatasync(spool.fd);
+		spool.dirty = false;
+	}
+}
+
+/* rewind a batch to be sent again */
+static void spool_rewind(void)
+{
+	int i;
+
+	for (i = 0; i < SPOOL_REPLAY_BATCH; i++) {
+		__atomic_store_n(&spool.mid[i], 0, __ATOMIC_SEQ_CST);
+	}
+	spool.resent += spool.inflight;
+	spool.inflight = 0;
+	spool.sent = 0;
+}
+
+static void spool_send_batch(void)
+{
+	int i;
+	uint32_t at = 0;
+	struct spool_rec *r;
+	const char *topic;
+	int qos = conf.mqtt.qos > 1 ? conf.mqtt.qos : 1;
+
+	__atomic_store_n(&spool.acked, 0, __ATOMIC_SEQ_CST);
+	spool.inflight_epoch = __atomic_load_n(&spool.epoch, __ATOMIC_SEQ_CST);
+	spool.inflight_since = time(NULL);
+	for (i = 0; i < SPOOL_REPLAY_BATCH && (r = spool_at(&at)) != NULL; i++) {
+		topic = (const char *)(r + 1);
+		if (!pub_publish_mid(topic, r->len, topic + r->topic_len, qos,
+		                     conf.mqtt.retain, &spool.mid[i])) {
+			__atomic_store_n(&spool.mid[i], 0, __ATOMIC_SEQ_CST);
+			break;
+		}
+		at += spool_rec_size(r);
+		spool.sent = at;
+		spool.inflight++;
+	}
+}
+
+/* settle the batch in flight, then send the next one if we can */
+static void spool_replay(void)
+{
+	if (spool.inflight > 0) {
+		if (__atomic_load_n(&spool.acked, __ATOMIC_SEQ_CST) ==
+		    spool.inflight) {
+			spool.replayed += spool.inflight;
+			spool.inflight = 0;
+			spool_advance(spool.sent);
+		} else if (__atomic_load_n(&spool.epoch, __ATOMIC_SEQ_CST) !=
+		           spool.inflight_epoch ||
+		           time(NULL) - spool.inflight_since >= SPOOL_ACK_TIMEOUT) {
+			spool_rewind();
+		} else {
+			return;
+		}
+	}
+	if (spool_online() && spool.file.used > 0) {
+		spool_send_batch();
+	}
+}
+
+static void spool_timeout(struct uloop_timeout *t)
+{
+	spool_replay();
+	spool_sync(false);
+	uloop_timeout_set(t, spool_online() && spool.file.used > 0 ?
+	                     SPOOL_REPLAY_INTERVAL : SPOOL_POLL_INTERVAL);
+}
+
+/* size in KiB, messages left by a previous run are kept if it still fits */
+bool spool_open(const char *path, unsigned int size)
+{
+	uint32_t bytes;
+	struct spool_file f;
+
+	spool_close();
+	if (size > SPOOL_SIZE_MAX) {
+		fprintf(stderr, "[spool] %u KiB does not fit, keeping %u KiB\n", size,
+		        SPOOL_SIZE_MAX);
+		size = SPOOL_SIZE_MAX;
+	} else if (size == 0) {
+		size = SPOOL_SIZE_DEFAULT;
+	}
+	bytes = size * 1024;
+	spool.data = malloc(bytes);
+	spool.fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (spool.data == NULL || spool.fd < 0) {
+		perror(path);
+		spool_close();
+		return false;
+	}
+	if (pread(spool.fd, &f, sizeof(f), 0) == sizeof(f) &&
+	    spool_valid(&f, bytes) &&
+	    pread(spool.fd, spool.data, bytes, sizeof(f)) == (ssize_t)bytes) {
+		spool.file = f;
+		spool.sync_from = f.head;
+		spool.unsynced = 0;
+		spool.dirty = false;
+	} else {
+		if (ftruncate(spool.fd, sizeof(f) + bytes) < 0) {
+			perror(path);
+			spool_close();
+			return false;
+		}
+		spool.file = (struct spool_file) {
+			.magic = SPOOL_MAGIC,
+			.size = bytes
+		};
+		spool_reset();
+	}
+	spool.synced = time(NULL);
+	spool.timer.cb = spool_timeout;
+	uloop_timeout_set(&spool.timer, SPOOL_POLL_INTERVAL);
+	return true;
+}
+
+/* a batch still in flight stays in the ring, to be sent again next time */
+void spool_close(void)
+{
+	if (spool.data != NULL && spool.fd >= 0) {
+		uloop_timeout_cancel(&spool.timer);
+		spool_sync(true);
+	}
+	if (spool.inflight > 0) {
+		spool_rewind();
+	}
+	free(spool.data);
+	spool.data = NULL;
+	if (spool.fd >= 0) {
+		close(spool.fd);
+		spool.fd = -1;
+	}
+}
+
+static void spool_put(const void *data, uint32_t len)
+{
+	struct spool_file *f = &spool.file;
+
+	memcpy(spool.data + f->head, data, len);
+	f->head += len;
+}
+
+/*
+ * Keep a counter message if it cannot be published now, or if older ones
+ * are still waiting. Returns false when the caller should publish it.
+ */
+bool spool_take(const char *topic, const char *data, int len)
+{
+	struct spool_file *f = &spool.file;
+	struct spool_rec r;
+	uint32_t need, waste;
+
+	if (spool.data == NULL) {
+		return false;
+	}
+	if (spool_online()) {
+		/* drain faster than we fill, whatever the message rate */
+		spool_replay();
+		if (f->used == 0) {
+			return false;
+		}
+	}
+	r.topic_len = strlen(topic) + 1;
+	r.len = len;
+	need = SPOOL_ALIGN(sizeof(r) + r.topic_len + len);
+	if (len < 0 || len > UINT16_MAX || strlen(topic) + 1 >= SPOOL_WRAP ||
+	    need > f->size / 2) {
+		return false;
+	}
+	waste = f->head + need > f->size ? f->size - f->head : 0;
+	while (f->size - f->used < waste + need && f->used > 0) {
+		spool_drop_oldest();
+		/* dropping may have emptied the ring and moved head back to 0 */
+		waste = f->head + need > f->size ? f->size - f->head : 0;
+	}
+	if (waste > 0) {
+		if (waste >= sizeof(r)) {
+			((struct spool_rec *)(spool.data + f->head))->topic_len =
+			    SPOOL_WRAP;
+		}
+		f->used += waste;
+		spool.unsynced += waste;
+		f->head = 0;
+	}
+	spool_put(&r, sizeof(r));
+	spool_put(topic, r.topic_len);
+	spool_put(data, len);
+	f->head = SPOOL_ALIGN(f->head) % f->size;
+	f->used += need;
+	spool.unsynced += need;
+	spool.dirty = true;
+	spool.spooled++;
+	return true;
+}
+
+void spool_stats_print(FILE *stream)
+{
+	if (spool.data == NULL) {
+		return;
+	}
+	fprintf(stream,
+	    "[spool] %llu spooled, %llu replayed, %llu sent again, %llu dropped, "
+	    "%u bytes held\n", spool.spooled, spool.replayed, spool.resent,
+	    spool.dropped, spool.file.used);
+}
@@ -0,0 +1,44 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Store-and-forward for counters. While the broker connection or its
+ * bridge is down, counter messages are appended to a ring instead of being
+ * published. Once both are back, they are replayed in order at QoS 1 or
+ * higher, a batch at a time. A batch only leaves the ring once the broker
+ * acknowledged all of it. A lost connection or SPOOL_ACK_TIMEOUT sends it
+ * again, so a replayed message arrives at least once. New counters keep
+ * going into the ring until it has drained, so per-topic order holds. A
+ * full ring drops its oldest messages.
+ *
+ * The ring lives in RAM. What changed is written to the spool file with
+ * pwrite() and fdatasync() every SPOOL_SYNC_INTERVAL and on shutdown, so
+ * a spool on flash sees a few batched writes per outage rather than one
+ * per message. A crash loses at most the last interval.
+ */
+#define SPOOL_MAGIC				0x464c5853 /* FLXS */
+#define SPOOL_SIZE_DEFAULT		256 /* KiB */
+#define SPOOL_SIZE_MAX			1024 /* KiB, all of it held in RAM */
+#define SPOOL_POLL_INTERVAL		1000 /* ms between checks while idle */
+#define SPOOL_REPLAY_INTERVAL	100 /* ms between replay batches */
+#define SPOOL_REPLAY_BATCH		16 /* messages per replay batch */
+#define SPOOL_ACK_TIMEOUT		10 /* s before a batch is sent again */
+#define SPOOL_SYNC_INTERVAL		60 /* s between writes of a dirty spool */
+
+enum spool_link {
+	SPOOL_LINK_BROKER,
+	SPOOL_LINK_BRIDGE
+};
+
+bool spool_open(const char *path, unsigned int size);
+void spool_close(void);
+void spool_set_link(enum spool_link link, bool up);
+void spool_on_publish(int mid);
+bool spool_take(const char *topic, const char *data, int len);
+void spool_stats_print(FILE *stream);
+
+#endif
@@ -0,0 +1,353 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* accept4() */
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <libubox/uloop.h>
+#include "config.h"
+#include "flx.h"
+#include "stream.h"
+
+#define STREAM_QUEUE_MASK (STREAM_QUEUE_SIZE - 1)
+
+struct stream_client {
+	struct uloop_fd ufd;
+	bool used;
+	bool writing; /* the socket is full, waiting to become writable */
+	uint32_t mask;
+	unsigned char rx[4]; /* mask being received */
+	size_t rx_len;
+	size_t head; /* next byte to send */
+	size_t len; /* bytes queued */
+	uint32_t lost; /* records dropped since the last dropped record */
+	unsigned long long records;
+	unsigned long long dropped;
+	unsigned char queue[STREAM_QUEUE_SIZE];
+};
+
+static struct {
+	char path[CONFIG_STR_MAX];
+	bool started;
+	struct uloop_fd ufd;
+	unsigned long long refused;
+	struct stream_client client[STREAM_CLIENTS_MAX];
+} stream = {
+	.ufd = {
+		.fd = -1
+	}
+};
+
+uint32_t stream_mask;
+
+static void stream_update_mask(void)
+{
+	int i;
+
+	stream_mask = 0;
+	for (i = 0; i < STREAM_CLIENTS_MAX; i++) {
+		if (stream.client[i].used) {
+			stream_mask |= stream.client[i].mask;
+		}
+	}
+}
+
+static void stream_client_close(struct stream_client *c)
+{
+	uloop_fd_delete(&c->ufd);
+	close(c->ufd.fd);
+	c->used = false;
+	stream_update_mask();
+	if (conf.verbosity > 0) {
+		fprintf(stdout, "[stream] client %d gone, %llu records, %llu dropped\n",
+		        (int)(c - stream.client), c->records, c->dropped);
+	}
+}
+
+static void stream_flush(struct stream_client *c)
+{
+	ssize_t n;
+	size_t chunk;
+
+	while (c->len > 0) {
+		chunk = STREAM_QUEUE_SIZE - c->head;
+		chunk = chunk < c->len ? chunk : c->len;
+		n = send(c->ufd.fd, &c->queue[c->head], chunk,
+		         MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				if (!c->writing) {
+					c->writing = true;
+					uloop_fd_add(&c->ufd, ULOOP_READ | ULOOP_WRITE);
+				}
+				return;
+			}
+			stream_client_close(c);
+			return;
+		}
+		c->head = (c->head + n) & STREAM_QUEUE_MASK;
+		c->len -= n;
+	}
+	if (c->writing) {
+		c->writing = false;
+		uloop_fd_add(&c->ufd, ULOOP_READ);
+	}
+}
+
+/* a client only ever sends masks, 4 bytes each */
+static void stream_client_read(struct stream_client *c)
+{
+	ssize_t n, i;
+	unsigned char buf[64];
+
+	for (;;) {
+		n = read(c->ufd.fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		}
+		if (n <= 0) {
+			stream_client_close(c);
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			c->rx[c->rx_len++] = buf[i];
+			if (c->rx_len == sizeof(c->rx)) {
+				c->mask = (c->rx[0] | c->rx[1] << 8 | c->rx[2] << 16 |
+				           (uint32_t)c->rx[3] << 24) &
+				          ((1U << FLX_MAX_TYPES) - 1);
+				c->rx_len = 0;
+				stream_update_mask();
+			}
+		}
+	}
+}
+
+static void stream_client_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	struct stream_client *c = container_of(ufd, struct stream_client, ufd);
+
+	if (events & ULOOP_WRITE) {
+		stream_flush(c);
+	}
+	if (c->used && (events & ULOOP_READ)) {
+		stream_client_read(c);
+	}
+}
+
+static void stream_accept_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	int i, fd;
+	struct stream_client *c;
+
+	while ((fd = accept4(ufd->fd, NULL, NULL,
+	                     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i = 0; i < STREAM_CLIENTS_MAX && stream.client[i].used; i++)
+			;
+		if (i == STREAM_CLIENTS_MAX) {
+			close(fd);
+			stream.refused++;
+			continue;
+		}
+		c = &stream.client[i];
+		memset(c, 0, offsetof(struct stream_client, queue));
+		c->used = true;
+		c->ufd.fd = fd;
+		c->ufd.cb = stream_client_cb;
+		uloop_fd_add(&c->ufd, ULOOP_READ);
+		if (conf.verbosity > 0) {
+			fprintf(stdout, "[stream] client %d connected\n", i);
+		}
+	}
+}
+
+static void stream_listen(void)
+{
+	int fd;
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX
+	};
+
+	if (stream.path[0] == '\0') {
+		return;
+	}
+	strncpy(addr.sun_path, stream.path, sizeof(addr.sun_path) - 1);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return;
+	}
+	unlink(stream.path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, STREAM_BACKLOG) < 0) {
+		perror(stream.path);
+		close(fd);
+		return;
+	}
+	stream.ufd.fd = fd;
+	stream.ufd.cb = stream_accept_cb;
+	uloop_fd_add(&stream.ufd, ULOOP_READ);
+}
+
+static void stream_unlisten(void)
+{
+	int i;
+
+	for (i = 0; i < STREAM_CLIENTS_MAX; i++) {
+		if (stream.client[i].used) {
+			stream_client_close(&stream.client[i]);
+		}
+	}
+	if (stream.ufd.fd >= 0) {
+		uloop_fd_delete(&stream.ufd);
+		close(stream.ufd.fd);
+		stream.ufd.fd = -1;
+		unlink(stream.path);
+	}
+}
+
+/* called on every config load, the socket only moves if the path does */
+void stream_configure(const char *path)
+{
+	if (strcmp(stream.path, path) == 0) {
+		return;
+	}
+	stream_unlisten();
+	strncpy(stream.path, path, CONFIG_STR_MAX - 1);
+	if (stream.started) {
+		stream_listen();
+	}
+}
+
+/* once uloop is up */
+void stream_start(void)
+{
+	stream.started = true;
+	stream_listen();
+}
+
+void stream_stop(void)
+{
+	stream_unlisten();
+	stream.started = false;
+}
+
+static void stream_put(struct stream_client *c, const unsigned char *data,
+                       size_t len)
+{
+	size_t tail = (c->head + c->len) & STREAM_QUEUE_MASK;
+	size_t chunk = STREAM_QUEUE_SIZE - tail;
+
+	chunk = chunk < len ? chunk : len;
+	memcpy(&c->queue[tail], data, chunk);
+	memcpy(c->queue, data + chunk, len - chunk);
+	c->len += len;
+}
+
+static void stream_put_head(struct stream_client *c, uint8_t type,
+                            size_t len)
+{
+	unsigned char head[STREAM_RECORD_HEAD] = {
+		(len + 1) & 0xff, (len + 1) >> 8, type
+	};
+
+	stream_put(c, head, sizeof(head));
+}
+
+static void stream_record(struct stream_client *c, uint8_t type,
+                          const unsigned char *payload, size_t len)
+{
+	unsigned char lost[4];
+	size_t need = STREAM_RECORD_HEAD + len;
+
+	if (c->lost > 0) {
+		need += STREAM_RECORD_HEAD + sizeof(lost);
+	}
+	if (STREAM_QUEUE_SIZE - c->len < need) {
+		c->lost++;
+		c->dropped++;
+		return;
+	}
+	if (c->lost > 0) {
+		lost[0] = c->lost & 0xff;
+		lost[1] = c->lost >> 8 & 0xff;
+		lost[2] = c->lost >> 16 & 0xff;
+		lost[3] = c->lost >> 24;
+		stream_put_head(c, STREAM_TYPE_DROPPED, sizeof(lost));
+		stream_put(c, lost, sizeof(lost));
+		c->lost = 0;
+	}
+	stream_put_head(c, type, len);
+	stream_put(c, payload, len);
+	c->records++;
+}
+
+void stream_frame(uint8_t type, const unsigned char *payload, size_t len)
+{
+	int i;
+	struct stream_client *c;
+
+	for (i = 0; i < STREAM_CLIENTS_MAX; i++) {
+		c = &stream.client[i];
+		if (!c->used || !(c->mask & (1U << type))) {
+			continue;
+		}
+		stream_record(c, type, payload, len);
+		if (!c->writing) {
+			stream_flush(c);
+		}
+	}
+}
+
+void stream_stats_print(FILE *stream_out)
+{
+	int i;
+	struct stream_client *c;
+
+	if (stream.ufd.fd < 0) {
+		return;
+	}
+	for (i = 0; i < STREAM_CLIENTS_MAX; i++) {
+		c = &stream.client[i];
+		if (c->used) {
+			fprintf(stream_out,
+			    "[stream] client %d: mask %#x, %llu records, %llu dropped, "
+			    "%zu bytes queued\n", i, c->mask, c->records, c->dropped,
+			    c->len);
+		}
+	}
+	fprintf(stream_out, "[stream] %llu clients refused\n", stream.refused);
+}
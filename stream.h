@@ -0,0 +1,42 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Local binary subscribers on the unix stream socket at flx.main.stream.
+ * A client writes a little endian u32 mask of the FLX frame types it
+ * wants, bit 1 << FLX_TYPE_*, and may write a new mask at any time. It
+ * then reads the payload of every such frame that passes its checksum,
+ * before any decoding, as records of
+ *
+ *   u16 le length of what follows | u8 type | payload
+ *
+ * Each client has a bounded queue. A record that does not fit is dropped
+ * and counted, and the next record that fits is preceded by a
+ * STREAM_TYPE_DROPPED record with the u32 le number of records lost in
+ * between, so a slow client never holds up decoding or other clients.
+ */
+#define STREAM_CLIENTS_MAX		8
+#define STREAM_QUEUE_SIZE		16384 /* bytes per client, power of two */
+#define STREAM_BACKLOG			4
+#define STREAM_TYPE_DROPPED		0xff
+#define STREAM_RECORD_HEAD		3
+
+extern uint32_t stream_mask; /* union of the client masks */
+
+void stream_configure(const char *path);
+void stream_start(void);
+void stream_stop(void);
+void stream_frame(uint8_t type, const unsigned char *payload, size_t len);
+void stream_stats_print(FILE *stream);
+
+static inline bool stream_wants(uint8_t type)
+{
+	return type < 32 && (stream_mask & (1U << type));
+}
+
+#endif
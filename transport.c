@@ -0,0 +1,276 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Bart Van Der Meerssche <bart@flukso.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* posix_openpt() and friends */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "transport.h"
+
+const char *transport2string[] = {
+	"tty", "pty", "unix", "file", "replay"
+};
+
+/*
+ * A transport spec is either a plain device path, which is opened as a tty,
+ * or one of <type>:<path> with type in transport2string. The pty type takes
+ * an optional path at which a symlink to the slave side is created.
+ */
+bool transport_parse(struct transport *t, const char *spec)
+{
+	int i;
+	size_t len;
+	const char *sep;
+
+	t->type = TRANSPORT_TTY;
+	t->fd = -1;
+	t->fd_hold = -1;
+	sep = strchr(spec, TRANSPORT_SPEC_SEP);
+	if (sep != NULL) {
+		len = sep - spec;
+		for (i = 0; i < TRANSPORT_MAX_TYPES; i++) {
+			if (strlen(transport2string[i]) == len &&
+			    strncmp(transport2string[i], spec, len) == 0) {
+				t->type = i;
+				spec = sep + 1;
+				break;
+			}
+		}
+	} else if (strcmp(spec, transport2string[TRANSPORT_PTY]) == 0) {
+		t->type = TRANSPORT_PTY;
+		spec += strlen(spec);
+	}
+	if (strlen(spec) >= TRANSPORT_SPEC_MAX) {
+		return false;
+	}
+	strcpy(t->path, spec);
+	return t->type == TRANSPORT_PTY || t->path[0] != '\0';
+}
+
+static bool transport_configure_tty(int fd, bool speed)
+{
+	struct termios term;
+
+	if (tcgetattr(fd, &term) == -1) {
+		return false;
+	}
+	if (speed && cfsetospeed(&term, TRANSPORT_TTY_SPEED) == -1) {
+		return false;
+	}
+	/* configure tty in raw mode */
+	term.c_iflag &= ~(BRKINT | ICRNL | IGNBRK | IGNCR | INLCR | INPCK |
+	                  ISTRIP | IXOFF | IXON | PARMRK);
+	term.c_oflag &= ~OPOST;
+	term.c_cflag &= ~PARENB;
+	term.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+	term.c_cc[VMIN] = 1;
+	term.c_cc[VTIME] = 0;
+	if (tcsetattr(fd, TCSAFLUSH, &term) == -1) {
+		return false;
+	}
+	return true;
+}
+
+static int transport_open_tty(struct transport *t)
+{
+	int fd;
+
+	fd = open(t->path, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		perror(t->path);
+		return -1;
+	}
+	if (!transport_configure_tty(fd, true)) {
+		fprintf(stderr, "%s: Failed to configure tty params\n", t->path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int transport_open_pty(struct transport *t)
+{
+	int fd;
+	char *slave;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) == -1 || unlockpt(fd) == -1 ||
+	    (slave = ptsname(fd)) == NULL) {
+		perror("pty");
+		goto error;
+	}
+	/* termios ioctls on the master apply to the slave's line discipline */
+	if (!transport_configure_tty(fd, false)) {
+		fprintf(stderr, "%s: Failed to configure tty params\n", slave);
+		goto error;
+	}
+	t->fd_hold = open(slave, O_RDWR | O_NOCTTY);
+	if (t->fd_hold < 0) {
+		perror(slave);
+		goto error;
+	}
+	if (t->path[0] != '\0') {
+		unlink(t->path);
+		if (symlink(slave, t->path) == -1) {
+			perror(t->path);
+			goto error;
+		}
+	}
+	fprintf(stdout, "[transport] pty slave at %s\n",
+	        t->path[0] != '\0' ? t->path : slave);
+	return fd;
+
+error:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+static int transport_open_unix(struct transport *t)
+{
+	int fd;
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, t->path); /* length checked by transport_parse */
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		perror(t->path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int transport_open_file(struct transport *t)
+{
+	int fd;
+
+	fd = open(t->path, O_RDONLY);
+	if (fd < 0) {
+		perror(t->path);
+	}
+	return fd;
+}
+
+int transport_open(struct transport *t)
+{
+	switch (t->type) {
+	case TRANSPORT_TTY:
+		t->fd = transport_open_tty(t);
+		break;
+	case TRANSPORT_PTY:
+		t->fd = transport_open_pty(t);
+		break;
+	case TRANSPORT_UNIX:
+		t->fd = transport_open_unix(t);
+		break;
+	case TRANSPORT_FILE:
+	case TRANSPORT_REPLAY:
+		t->fd = transport_open_file(t);
+		break;
+	default:
+		t->fd = -1;
+		break;
+	}
+	/* flx_rx drains the fd until EAGAIN */
+	if (t->fd >= 0 && fcntl(t->fd, F_SETFL,
+	                        fcntl(t->fd, F_GETFL) | O_NONBLOCK) == -1) {
+		perror(t->path);
+		close(t->fd);
+		t->fd = -1;
+	}
+	return t->fd;
+}
+
+static long long transport_now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+/*
+ * The fd is non-blocking, so wait for room in the tx queue, but for no
+ * more than TRANSPORT_WRITE_TIMEOUT over the whole telegram: a trickling
+ * tty must not keep uloop, and with it rx, waiting.
+ */
+ssize_t transport_write(struct transport *t, const void *data, size_t len)
+{
+	struct pollfd pfd = { .fd = t->fd, .events = POLLOUT };
+	ssize_t n, done = 0;
+	long long left, deadline;
+
+	if (t->type == TRANSPORT_FILE || t->type == TRANSPORT_REPLAY) {
+		/* a capture file has nobody listening, so swallow the telegram */
+		return len;
+	}
+	deadline = transport_now_ms() + TRANSPORT_WRITE_TIMEOUT;
+	while ((size_t)done < len) {
+		n = write(t->fd, (const char *)data + done, len - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && errno == EAGAIN &&
+		    (left = deadline - transport_now_ms()) > 0 &&
+		    poll(&pfd, 1, left) > 0) {
+			continue;
+		}
+		if (n < 0) {
+			return done > 0 ? done : -1;
+		}
+		done += n;
+	}
+	return done;
+}
+
+void transport_close(struct transport *t)
+{
+	if (t->fd >= 0) {
+		close(t->fd);
+		t->fd = -1;
+	}
+	if (t->fd_hold >= 0) {
+		close(t->fd_hold);
+		t->fd_hold = -1;
+	}
+	if (t->type == TRANSPORT_PTY && t->path[0] != '\0') {
+		unlink(t->path);
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define TRANSPORT_SPEC_MAX			108 /* sizeof(sun_path) */
+#define TRANSPORT_SPEC_SEP			':'
+#define TRANSPORT_TTY_SPEED			B460800
+#define TRANSPORT_WRITE_TIMEOUT		100 /* ms per telegram */
+
+enum transport_type {
+	TRANSPORT_TTY,
+	TRANSPORT_PTY,
+	TRANSPORT_UNIX,
+	TRANSPORT_FILE,
+	TRANSPORT_REPLAY,
+	TRANSPORT_MAX_TYPES
+};
+
+struct transport {
+	enum transport_type type;
+	char path[TRANSPORT_SPEC_MAX];
+	int fd;
+	int fd_hold; /* keeps the pty slave open so the master never sees EIO */
+};
+
+extern const char *transport2string[];
+
+bool transport_parse(struct transport *t, const char *spec);
+int transport_open(struct transport *t);
+ssize_t transport_write(struct transport *t, const void *data, size_t len);
+void transport_close(struct transport *t);
+
+#endif